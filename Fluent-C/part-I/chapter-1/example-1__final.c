@@ -1,15 +1,65 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-#define ERROR ""
+#define ERROR -1
 #define BUFFER_SIZE 0
 #define NO_KEYWORD_FOUND 0
-#define KEYWORD_ONE_FOUND_FIRST ""
-#define KEYWORD_TWO_FOUND_FIRST ""
+#define KEYWORD_ONE_FOUND_FIRST 1
+#define KEYWORD_TWO_FOUND_FIRST 2
+#define KEYWORD_FOUND 3
+
+#define ALPHABET_SIZE 256
+/* longest unfinished line a streaming parser keeps between two feeds */
+#define STREAM_CARRY_SIZE 32
+
+/* Aho-Corasick automaton over an arbitrary set of keywords. Every state has a
+complete transition row, so scanning costs one table lookup per input byte
+regardless of how many keywords are searched for. */
+typedef struct
+{
+    int *transitions;      /* `state_count * ALPHABET_SIZE` next states */
+    int *match;            /* keyword ending in a state (longest one) or -1 */
+    size_t *keyword_length;
+    size_t max_keyword_length;
+    int keyword_count;
+    int state_count;
+} KeywordMatcher;
+
+/* Position of the keyword that was found first */
+typedef struct
+{
+    int keyword; /* index into the keyword set passed to the parser */
+    size_t offset; /* byte offset of the first keyword character */
+} KeywordMatch;
 
 typedef struct
 {
     FILE *file_pointer;
     char *buffer;
+    /* only used by parsers created with `createMappedParser` */
+    KeywordMatcher *matcher;
+    /* file mapping of `createMappedParser` and `searchFileForKeywordsVectorized` */
+    const char *mapped_data;
+    size_t mapped_size;
+    /* state of `parserFeed` carried over between two chunks of a stream */
+    char stream_line[STREAM_CARRY_SIZE]; /* start of the unfinished line */
+    size_t stream_line_length;           /* total length of the unfinished line */
+    int stream_result;
 } FileParser;
 
 int parseFile(char *file_name)
@@ -44,7 +94,7 @@ int searchFileForKeywords(FileParser *parser)
 FileParser *createParser(char *file_name)
 {
     assert(file_name != NULL && "Invalid filename");
-    FileParser *parser = malloc(sizeof(FileParser));
+    FileParser *parser = calloc(1, sizeof(FileParser));
     if (parser)
     {
         parser->file_pointer = fopen(file_name, "r");
@@ -58,6 +108,917 @@ FileParser *createParser(char *file_name)
     return parser;
 }
 
+void cleanupKeywordMatcher(KeywordMatcher *matcher)
+{
+    if (matcher)
+    {
+        free(matcher->transitions);
+        free(matcher->match);
+        free(matcher->keyword_length);
+        free(matcher);
+    }
+}
+
+/* Builds the automaton for the `keyword_count` provided `keywords` (none of
+them may be `NULL` or empty). Returns `NULL` in case of insufficient memory. */
+KeywordMatcher *createKeywordMatcher(const char **keywords, int keyword_count)
+{
+    assert(keywords != NULL && keyword_count > 0 && "Invalid keyword set");
+    KeywordMatcher *matcher = calloc(1, sizeof(KeywordMatcher));
+    int *fail = NULL;
+    int *queue = NULL;
+    if (matcher == NULL)
+    {
+        return NULL;
+    }
+    /* the trie can never have more states than keyword characters plus the root */
+    size_t max_states = 1;
+    for (int i = 0; i < keyword_count; i++)
+    {
+        assert(keywords[i] != NULL && keywords[i][0] != '\0' && "Invalid keyword");
+        max_states += strlen(keywords[i]);
+    }
+    matcher->keyword_count = keyword_count;
+    matcher->keyword_length = malloc(keyword_count * sizeof(size_t));
+    matcher->transitions = malloc(max_states * ALPHABET_SIZE * sizeof(int));
+    matcher->match = malloc(max_states * sizeof(int));
+    fail = malloc(max_states * sizeof(int));
+    queue = malloc(max_states * sizeof(int));
+    if (!matcher->keyword_length || !matcher->transitions || !matcher->match || !fail || !queue)
+    {
+        goto error;
+    }
+
+    /* insert all keywords into the trie; -1 marks a missing edge */
+    memset(matcher->transitions, -1, ALPHABET_SIZE * sizeof(int));
+    matcher->match[0] = -1;
+    matcher->state_count = 1;
+    for (int i = 0; i < keyword_count; i++)
+    {
+        int state = 0;
+        const unsigned char *c = (const unsigned char *)keywords[i];
+        for (; *c != '\0'; c++)
+        {
+            int *next = &matcher->transitions[state * ALPHABET_SIZE + *c];
+            if (*next == -1)
+            {
+                *next = matcher->state_count++;
+                memset(&matcher->transitions[*next * ALPHABET_SIZE], -1, ALPHABET_SIZE * sizeof(int));
+                matcher->match[*next] = -1;
+            }
+            state = *next;
+        }
+        if (matcher->match[state] == -1)
+        {
+            matcher->match[state] = i;
+        }
+        matcher->keyword_length[i] = (const char *)c - keywords[i];
+        if (matcher->keyword_length[i] > matcher->max_keyword_length)
+        {
+            matcher->max_keyword_length = matcher->keyword_length[i];
+        }
+    }
+
+    /* breadth-first pass: compute failure links and turn the trie into a
+    complete transition table, so that scanning never follows failure links */
+    int head = 0;
+    int tail = 0;
+    for (int c = 0; c < ALPHABET_SIZE; c++)
+    {
+        int next = matcher->transitions[c];
+        if (next == -1)
+        {
+            matcher->transitions[c] = 0;
+        }
+        else
+        {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail)
+    {
+        int state = queue[head++];
+        int *row = &matcher->transitions[state * ALPHABET_SIZE];
+        const int *fail_row = &matcher->transitions[fail[state] * ALPHABET_SIZE];
+        for (int c = 0; c < ALPHABET_SIZE; c++)
+        {
+            if (row[c] == -1)
+            {
+                row[c] = fail_row[c];
+            }
+            else
+            {
+                fail[row[c]] = fail_row[c];
+                if (matcher->match[row[c]] == -1)
+                {
+                    matcher->match[row[c]] = matcher->match[fail_row[c]];
+                }
+                queue[tail++] = row[c];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    return matcher;
+
+error:
+    free(fail);
+    free(queue);
+    cleanupKeywordMatcher(matcher);
+    return NULL;
+}
+
+/* Feeds `length` bytes of `data` into the automaton, starting in `*state`
+(0 for the beginning of the input). Returns the index of the keyword that
+starts first within `data` (the longest one if several start there) and
+stores the position of its last byte in `end`, or returns -1 if none was
+found. After a hit, `*state` is the state right after `end`, so the search
+can be continued at `data + *end + 1`; otherwise it is the state after the
+last byte, so the same call can be continued with the next piece of input. */
+int runKeywordMatcher(const KeywordMatcher *matcher, const char *data, size_t length,
+                      int *state, size_t *end)
+{
+    const int *transitions = matcher->transitions;
+    const unsigned char *bytes = (const unsigned char *)data;
+    int current = *state;
+    int best = -1;
+    size_t best_start = 0;
+    size_t limit = length;
+    for (size_t i = 0; i < limit; i++)
+    {
+        current = transitions[current * ALPHABET_SIZE + bytes[i]];
+        int keyword = matcher->match[current];
+        if (keyword == -1)
+        {
+            continue;
+        }
+        /* the stored keyword is the longest one ending here, so it also has
+        the earliest start among them; one with the same start as the best
+        so far ends later and is therefore longer */
+        size_t start = i + 1 - matcher->keyword_length[keyword];
+        if (best == -1 || start <= best_start)
+        {
+            best = keyword;
+            best_start = start;
+            *state = current;
+            *end = i;
+        }
+        if (best_start + matcher->max_keyword_length < limit)
+        {
+            /* a keyword starting before `best_start` must end before this */
+            limit = best_start + matcher->max_keyword_length;
+        }
+    }
+    if (best == -1)
+    {
+        *state = current;
+    }
+    return best;
+}
+
+/* Maps the whole file behind `fd` read-only into the parser. Empty files are
+valid and simply result in an empty mapping. Returns 0 on success. */
+static int mapParserDescriptor(FileParser *parser, int fd)
+{
+    struct stat file_status;
+    if (fstat(fd, &file_status) == -1 || !S_ISREG(file_status.st_mode))
+    {
+        return -1;
+    }
+    if (file_status.st_size > 0)
+    {
+        void *data = mmap(NULL, file_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            return -1;
+        }
+        madvise(data, file_status.st_size, MADV_SEQUENTIAL);
+        parser->mapped_data = data;
+        parser->mapped_size = file_status.st_size;
+    }
+    return 0;
+}
+
+static int mapParserFile(FileParser *parser, char *file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    int return_value = mapParserDescriptor(parser, fd);
+    /* the mapping stays valid after the descriptor is closed */
+    close(fd);
+    return return_value;
+}
+
+/* Creates a parser that memory-maps `file_name` and searches it for any of
+the `keyword_count` provided `keywords` in a single pass. */
+FileParser *createMappedParser(char *file_name, const char **keywords, int keyword_count)
+{
+    assert(file_name != NULL && "Invalid filename");
+    FileParser *parser = calloc(1, sizeof(FileParser));
+    if (parser)
+    {
+        parser->matcher = createKeywordMatcher(keywords, keyword_count);
+        if (!parser->matcher || mapParserFile(parser, file_name) != 0)
+        {
+            cleanupParser(parser);
+            return NULL;
+        }
+    }
+    return parser;
+}
+
+/* Searches the mapped file for the keyword that occurs first. Stores the
+keyword index and its byte offset into `match` (must not be `NULL`) and
+returns `KEYWORD_FOUND`, or returns `NO_KEYWORD_FOUND`. */
+int searchMappedFileForKeywords(FileParser *parser, KeywordMatch *match)
+{
+    assert(match != NULL && "Invalid match");
+    if (parser == NULL || parser->matcher == NULL)
+    {
+        return ERROR;
+    }
+    int state = 0;
+    size_t end;
+    int keyword = runKeywordMatcher(parser->matcher, parser->mapped_data,
+                                    parser->mapped_size, &state, &end);
+    if (keyword == -1)
+    {
+        return NO_KEYWORD_FOUND;
+    }
+    match->keyword = keyword;
+    match->offset = end + 1 - parser->matcher->keyword_length[keyword];
+    return KEYWORD_FOUND;
+}
+
+int parseMappedFile(char *file_name, const char **keywords, int keyword_count, KeywordMatch *match)
+{
+    int return_value;
+    FileParser *parser = createMappedParser(file_name, keywords, keyword_count);
+    return_value = searchMappedFileForKeywords(parser, match);
+    cleanupParser(parser);
+    return return_value;
+}
+
+////////// Vectorized line search //////////
+
+#define LINE_BLOCK_SIZE 32
+
+/* The lines searched for by `searchFileForKeywords`, including the newline */
+static const struct
+{
+    const char *line;
+    size_t length;
+    int result;
+} line_keywords[] = {
+    {"KEYWORD_ONE\n", sizeof("KEYWORD_ONE\n") - 1, KEYWORD_ONE_FOUND_FIRST},
+    {"KEYWORD_TWO\n", sizeof("KEYWORD_TWO\n") - 1, KEYWORD_TWO_FOUND_FIRST},
+};
+#define LINE_KEYWORD_COUNT (sizeof(line_keywords) / sizeof(line_keywords[0]))
+
+/* Computes for up to `LINE_BLOCK_SIZE` bytes of `block` one bit per byte telling
+whether the byte is a newline and whether it is the first byte of any keyword line */
+typedef void (*LineMaskFunction)(const char *block, size_t length,
+                                 uint32_t *newlines, uint32_t *first_bytes);
+
+static void computeLineMasksScalar(const char *block, size_t length,
+                                   uint32_t *newlines, uint32_t *first_bytes)
+{
+    *newlines = 0;
+    *first_bytes = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (block[i] == '\n')
+        {
+            *newlines |= (uint32_t)1 << i;
+        }
+        for (size_t k = 0; k < LINE_KEYWORD_COUNT; k++)
+        {
+            if (block[i] == line_keywords[k].line[0])
+            {
+                *first_bytes |= (uint32_t)1 << i;
+            }
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/* `length` is always `LINE_BLOCK_SIZE` for the vector versions */
+static void computeLineMasksSse2(const char *block, size_t length,
+                                 uint32_t *newlines, uint32_t *first_bytes)
+{
+    (void)length;
+    __m128i low = _mm_loadu_si128((const __m128i *)block);
+    __m128i high = _mm_loadu_si128((const __m128i *)(block + 16));
+    __m128i newline = _mm_set1_epi8('\n');
+    *newlines = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(low, newline)) |
+                (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(high, newline)) << 16;
+    *first_bytes = 0;
+    for (size_t k = 0; k < LINE_KEYWORD_COUNT; k++)
+    {
+        __m128i first = _mm_set1_epi8(line_keywords[k].line[0]);
+        *first_bytes |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(low, first)) |
+                        (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(high, first)) << 16;
+    }
+}
+
+__attribute__((target("avx2"))) static void computeLineMasksAvx2(const char *block, size_t length,
+                                                                  uint32_t *newlines, uint32_t *first_bytes)
+{
+    (void)length;
+    __m256i data = _mm256_loadu_si256((const __m256i *)block);
+    *newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, _mm256_set1_epi8('\n')));
+    *first_bytes = 0;
+    for (size_t k = 0; k < LINE_KEYWORD_COUNT; k++)
+    {
+        __m256i first = _mm256_set1_epi8(line_keywords[k].line[0]);
+        *first_bytes |= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, first));
+    }
+}
+#endif
+
+/* Picks the widest kernel the CPU supports (SSE2 is part of every x86-64 CPU) */
+static LineMaskFunction selectLineMaskFunction()
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return computeLineMasksAvx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return computeLineMasksSse2;
+    }
+#endif
+    return computeLineMasksScalar;
+}
+
+/* Full compare of the line starting at `line` against all keyword lines */
+static int matchLineKeyword(const char *line, size_t remaining)
+{
+    for (size_t k = 0; k < LINE_KEYWORD_COUNT; k++)
+    {
+        size_t length = line_keywords[k].length;
+        if (remaining >= length && line[length - 1] == '\n' &&
+            memcmp(line, line_keywords[k].line, length) == 0)
+        {
+            return line_keywords[k].result;
+        }
+    }
+    return NO_KEYWORD_FOUND;
+}
+
+static int searchBufferWithMasks(LineMaskFunction computeMasks, const char *data,
+                                 size_t length, size_t *offset)
+{
+    /* the first byte of the buffer always starts a line */
+    uint32_t line_start_carry = 1;
+    for (size_t block = 0; block < length; block += LINE_BLOCK_SIZE)
+    {
+        uint32_t newlines;
+        uint32_t first_bytes;
+        size_t block_length = length - block;
+        if (block_length >= LINE_BLOCK_SIZE)
+        {
+            computeMasks(data + block, LINE_BLOCK_SIZE, &newlines, &first_bytes);
+        }
+        else
+        {
+            computeLineMasksScalar(data + block, block_length, &newlines, &first_bytes);
+        }
+        /* only lines starting with the first byte of a keyword are compared */
+        uint32_t candidates = first_bytes & ((newlines << 1) | line_start_carry);
+        line_start_carry = newlines >> (LINE_BLOCK_SIZE - 1);
+        while (candidates != 0)
+        {
+            size_t start = block + __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            int result = matchLineKeyword(data + start, length - start);
+            if (result != NO_KEYWORD_FOUND)
+            {
+                if (offset != NULL)
+                {
+                    *offset = start;
+                }
+                return result;
+            }
+        }
+    }
+    return NO_KEYWORD_FOUND;
+}
+
+static LineMaskFunction line_mask_function;
+static pthread_once_t line_mask_once = PTHREAD_ONCE_INIT;
+
+static void initLineMaskFunction()
+{
+    line_mask_function = selectLineMaskFunction();
+}
+
+/* Searches the caller-supplied buffer `data` of `length` bytes for the first
+line that is exactly one of the keyword lines of `searchFileForKeywords`.
+Returns the same result codes and, if `offset` is not `NULL`, stores the
+byte offset of the matching line. */
+int searchBufferForKeywords(const char *data, size_t length, size_t *offset)
+{
+    pthread_once(&line_mask_once, initLineMaskFunction);
+    return searchBufferWithMasks(line_mask_function, data, length, offset);
+}
+
+/* Scalar reference version of `searchBufferForKeywords` with identical results */
+int searchBufferForKeywordsScalar(const char *data, size_t length, size_t *offset)
+{
+    return searchBufferWithMasks(computeLineMasksScalar, data, length, offset);
+}
+
+/* Same as `searchFileForKeywords`, but maps the parser's file and runs the
+vectorized kernel over it. Falls back to the line-by-line search if the
+file cannot be mapped (for example, a pipe). */
+int searchFileForKeywordsVectorized(FileParser *parser)
+{
+    if (parser == NULL)
+    {
+        return ERROR;
+    }
+    if (parser->mapped_data == NULL && parser->file_pointer != NULL &&
+        mapParserDescriptor(parser, fileno(parser->file_pointer)) != 0)
+    {
+        return searchFileForKeywords(parser);
+    }
+    return searchBufferForKeywords(parser->mapped_data, parser->mapped_size, NULL);
+}
+
+////////// Parallel search //////////
+
+/* nominal size of the line-aligned chunks the workers pick up */
+#define PARALLEL_CHUNK_SIZE (4 * 1024 * 1024)
+
+/* State shared by all workers of one `parseFileParallel` call */
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t chunk_count;
+    atomic_size_t next_chunk;
+    /* lowest chunk that produced a match (`chunk_count` if none did yet);
+    workers stop as soon as the only chunks left are behind this one */
+    atomic_size_t best_chunk;
+    pthread_mutex_t result_mutex;
+    int result;
+} ParallelSearch;
+
+/* Moves `position` to the start of the next line, so that every line
+belongs to exactly one chunk */
+static size_t alignToLineStart(const char *data, size_t size, size_t position)
+{
+    if (position == 0 || position >= size)
+    {
+        return position < size ? position : size;
+    }
+    const char *newline = memchr(data + position - 1, '\n', size - position + 1);
+    return newline ? (size_t)(newline - data) + 1 : size;
+}
+
+static void *parallelSearchWorker(void *argument)
+{
+    ParallelSearch *search = argument;
+    for (;;)
+    {
+        size_t chunk = atomic_fetch_add(&search->next_chunk, 1);
+        /* chunks are handed out in file order, so all later ones can only
+        produce matches behind the one already found */
+        if (chunk >= search->chunk_count || chunk > atomic_load(&search->best_chunk))
+        {
+            return NULL;
+        }
+        size_t start = alignToLineStart(search->data, search->size, chunk * PARALLEL_CHUNK_SIZE);
+        size_t end = alignToLineStart(search->data, search->size, (chunk + 1) * PARALLEL_CHUNK_SIZE);
+        int result = searchBufferForKeywords(search->data + start, end - start, NULL);
+        if (result != NO_KEYWORD_FOUND)
+        {
+            pthread_mutex_lock(&search->result_mutex);
+            if (chunk < atomic_load(&search->best_chunk))
+            {
+                atomic_store(&search->best_chunk, chunk);
+                search->result = result;
+            }
+            pthread_mutex_unlock(&search->result_mutex);
+        }
+    }
+}
+
+/* Same result as `parseFile`, but the file is mapped and split into
+line-aligned chunks that are scanned by `threads` threads (including the
+calling one). The match with the smallest offset wins. Files that cannot be
+mapped are searched with `parseFile`. */
+int parseFileParallel(char *file_name, int threads)
+{
+    assert(file_name != NULL && "Invalid filename");
+    assert(threads > 0 && "Invalid thread count");
+    FileParser parser = {0};
+    if (mapParserFile(&parser, file_name) != 0)
+    {
+        return parseFile(file_name);
+    }
+    ParallelSearch search = {
+        .data = parser.mapped_data,
+        .size = parser.mapped_size,
+        .chunk_count = (parser.mapped_size + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE,
+        .result = NO_KEYWORD_FOUND,
+    };
+    atomic_init(&search.next_chunk, 0);
+    atomic_init(&search.best_chunk, search.chunk_count);
+    pthread_mutex_init(&search.result_mutex, NULL);
+
+    pthread_t *workers = calloc(threads - 1, sizeof(pthread_t));
+    int started = 0;
+    /* if no (or not all) workers can be started, the calling thread still
+    processes all remaining chunks on its own */
+    while (workers != NULL && started < threads - 1 &&
+           pthread_create(&workers[started], NULL, parallelSearchWorker, &search) == 0)
+    {
+        started++;
+    }
+    parallelSearchWorker(&search);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&search.result_mutex);
+    if (parser.mapped_data)
+    {
+        munmap((void *)parser.mapped_data, parser.mapped_size);
+    }
+    return search.result;
+}
+
+////////// Batch search //////////
+
+/* initial size of the read buffer each batch worker reuses for all its files */
+#define BATCH_BUFFER_SIZE (64 * 1024)
+/* files larger than this are mapped instead of read into the buffer */
+#define BATCH_MAP_THRESHOLD (16 * 1024 * 1024)
+
+/* Result of one file of a batch */
+typedef struct
+{
+    int path_index; /* index into the batch's list of file names */
+    int result;     /* same codes as `parseFile` */
+    size_t offset;  /* offset of the matching line if a keyword was found */
+} BatchResult;
+
+/* Files of a batch and their results, as created by `parseDirectoryBatch` */
+typedef struct
+{
+    char **file_names;
+    BatchResult *results;
+    int file_count;
+    char *name_storage; /* all file names back to back */
+} ParseBatch;
+
+/* State shared by all workers of one batch */
+typedef struct
+{
+    char **file_names;
+    int file_count;
+    BatchResult *results;
+    atomic_int next_file;
+} BatchSearch;
+
+/* Searches one file with the worker's reusable `parser`, whose buffer of
+`*buffer_size` bytes only grows when a file does not fit into it */
+static int searchBatchFile(FileParser *parser, size_t *buffer_size, char *file_name, size_t *offset)
+{
+    struct stat file_status;
+    int return_value = ERROR;
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return ERROR;
+    }
+    if (fstat(fd, &file_status) == -1 || !S_ISREG(file_status.st_mode))
+    {
+        goto cleanup;
+    }
+    if (file_status.st_size > BATCH_MAP_THRESHOLD)
+    {
+        if (mapParserDescriptor(parser, fd) == 0)
+        {
+            return_value = searchBufferForKeywords(parser->mapped_data, parser->mapped_size, offset);
+            munmap((void *)parser->mapped_data, parser->mapped_size);
+            parser->mapped_data = NULL;
+            parser->mapped_size = 0;
+        }
+        goto cleanup;
+    }
+    if ((size_t)file_status.st_size > *buffer_size)
+    {
+        char *buffer = realloc(parser->buffer, file_status.st_size);
+        if (buffer == NULL)
+        {
+            goto cleanup;
+        }
+        parser->buffer = buffer;
+        *buffer_size = file_status.st_size;
+    }
+    size_t length = 0;
+    while (length < (size_t)file_status.st_size)
+    {
+        ssize_t read_bytes = read(fd, parser->buffer + length, file_status.st_size - length);
+        if (read_bytes == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (read_bytes == -1)
+        {
+            goto cleanup;
+        }
+        if (read_bytes == 0)
+        {
+            /* the file was truncated since `fstat` */
+            break;
+        }
+        length += read_bytes;
+    }
+    return_value = searchBufferForKeywords(parser->buffer, length, offset);
+cleanup:
+    close(fd);
+    return return_value;
+}
+
+static void *batchSearchWorker(void *argument)
+{
+    BatchSearch *batch = argument;
+    FileParser parser = {0};
+    size_t buffer_size = BATCH_BUFFER_SIZE;
+    parser.buffer = malloc(buffer_size);
+    for (;;)
+    {
+        int i = atomic_fetch_add(&batch->next_file, 1);
+        if (i >= batch->file_count)
+        {
+            break;
+        }
+        BatchResult *result = &batch->results[i];
+        result->path_index = i;
+        result->offset = 0;
+        result->result = parser.buffer ? searchBatchFile(&parser, &buffer_size, batch->file_names[i], &result->offset)
+                                       : ERROR;
+    }
+    free(parser.buffer);
+    return NULL;
+}
+
+/* Searches each of the `file_count` files in `file_names` like `parseFile`
+does, using `threads` threads (including the calling one). Each thread
+reuses one parser and read buffer for all of its files. Stores the result
+of `file_names[i]` into `results[i]`, which has to be provided by the caller. */
+void parseFileBatch(char **file_names, int file_count, int threads, BatchResult *results)
+{
+    assert(file_names != NULL && results != NULL && "Invalid batch");
+    assert(threads > 0 && "Invalid thread count");
+    BatchSearch batch = {
+        .file_names = file_names,
+        .file_count = file_count,
+        .results = results,
+    };
+    atomic_init(&batch.next_file, 0);
+    pthread_t *workers = calloc(threads - 1, sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 && started < file_count - 1 &&
+           pthread_create(&workers[started], NULL, batchSearchWorker, &batch) == 0)
+    {
+        started++;
+    }
+    batchSearchWorker(&batch);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+
+void cleanupParseBatch(ParseBatch *batch)
+{
+    if (batch)
+    {
+        free(batch->file_names);
+        free(batch->results);
+        free(batch->name_storage);
+        free(batch);
+    }
+}
+
+/* Collects the paths of all regular files directly inside `directory_name`.
+Returns 0 on success. */
+static int collectDirectoryFiles(ParseBatch *batch, char *directory_name)
+{
+    size_t storage_size = 0;
+    size_t storage_capacity = 0;
+    size_t *name_offsets = NULL;
+    int capacity = 0;
+    int return_value = -1;
+    struct dirent *directory_entry;
+    DIR *directory = opendir(directory_name);
+    if (directory == NULL)
+    {
+        return -1;
+    }
+    size_t directory_length = strlen(directory_name);
+    while ((directory_entry = readdir(directory)) != NULL)
+    {
+        if (directory_entry->d_type != DT_REG && directory_entry->d_type != DT_UNKNOWN)
+        {
+            continue;
+        }
+        /* names are stored as offsets first, because the storage may still move */
+        size_t path_size = directory_length + strlen(directory_entry->d_name) + 2;
+        if (storage_size + path_size > storage_capacity || batch->file_count == capacity)
+        {
+            storage_capacity = storage_capacity * 2 + path_size + BATCH_BUFFER_SIZE;
+            capacity = capacity * 2 + 64;
+            char *storage = realloc(batch->name_storage, storage_capacity);
+            size_t *offsets = storage ? realloc(name_offsets, capacity * sizeof(size_t)) : NULL;
+            if (storage)
+            {
+                batch->name_storage = storage;
+            }
+            if (offsets == NULL)
+            {
+                goto cleanup;
+            }
+            name_offsets = offsets;
+        }
+        name_offsets[batch->file_count++] = storage_size;
+        storage_size += snprintf(batch->name_storage + storage_size, path_size, "%s/%s",
+                                 directory_name, directory_entry->d_name) + 1;
+    }
+    batch->file_names = malloc((batch->file_count ? batch->file_count : 1) * sizeof(char *));
+    batch->results = malloc((batch->file_count ? batch->file_count : 1) * sizeof(BatchResult));
+    if (batch->file_names && batch->results)
+    {
+        for (int i = 0; i < batch->file_count; i++)
+        {
+            batch->file_names[i] = batch->name_storage + name_offsets[i];
+        }
+        return_value = 0;
+    }
+cleanup:
+    free(name_offsets);
+    closedir(directory);
+    return return_value;
+}
+
+/* Searches all regular files inside `directory_name` with `parseFileBatch`.
+Returns the batch holding the file names and results (to be released with
+`cleanupParseBatch`) or `NULL` on error. */
+ParseBatch *parseDirectoryBatch(char *directory_name, int threads)
+{
+    assert(directory_name != NULL && "Invalid directory name");
+    ParseBatch *batch = calloc(1, sizeof(ParseBatch));
+    if (batch)
+    {
+        if (collectDirectoryFiles(batch, directory_name) != 0)
+        {
+            cleanupParseBatch(batch);
+            return NULL;
+        }
+        parseFileBatch(batch->file_names, batch->file_count, threads, batch->results);
+    }
+    return batch;
+}
+
+////////// Streaming search //////////
+
+/* size of the buffer `parseDescriptor` reads into */
+#define STREAM_READ_SIZE (64 * 1024)
+
+/* Creates a parser that is not bound to a file, but gets its input pushed
+via `parserFeed`. Returns `NULL` in case of insufficient memory. */
+FileParser *createStreamParser()
+{
+    FileParser *parser = calloc(1, sizeof(FileParser));
+    if (parser)
+    {
+        parser->buffer = malloc(STREAM_READ_SIZE);
+        if (!parser->buffer)
+        {
+            cleanupParser(parser);
+            return NULL;
+        }
+        parser->stream_result = NO_KEYWORD_FOUND;
+    }
+    return parser;
+}
+
+/* Searches the next `length` bytes of the stream with the same semantics as
+`searchFileForKeywords`. Lines may be split across any number of feeds; only
+the unfinished last line is kept, and only as far as a keyword could still
+match it. Returns the result found so far, so feeding can stop as soon as
+this is not `NO_KEYWORD_FOUND`. */
+int parserFeed(FileParser *parser, const char *bytes, size_t length)
+{
+    if (parser == NULL || (bytes == NULL && length > 0))
+    {
+        return ERROR;
+    }
+    if (parser->stream_result != NO_KEYWORD_FOUND || length == 0)
+    {
+        return parser->stream_result;
+    }
+    size_t position = 0;
+    if (parser->stream_line_length > 0)
+    {
+        /* complete the line that was started by the previous feed */
+        const char *newline = memchr(bytes, '\n', length);
+        size_t head = newline ? (size_t)(newline - bytes) + 1 : length;
+        if (parser->stream_line_length < STREAM_CARRY_SIZE)
+        {
+            size_t space = STREAM_CARRY_SIZE - parser->stream_line_length;
+            memcpy(parser->stream_line + parser->stream_line_length, bytes, head < space ? head : space);
+        }
+        parser->stream_line_length += head;
+        if (newline == NULL)
+        {
+            return NO_KEYWORD_FOUND;
+        }
+        if (parser->stream_line_length <= STREAM_CARRY_SIZE)
+        {
+            parser->stream_result = matchLineKeyword(parser->stream_line, parser->stream_line_length);
+        }
+        parser->stream_line_length = 0;
+        if (parser->stream_result != NO_KEYWORD_FOUND)
+        {
+            return parser->stream_result;
+        }
+        position = head;
+    }
+    parser->stream_result = searchBufferForKeywords(bytes + position, length - position, NULL);
+    if (parser->stream_result == NO_KEYWORD_FOUND)
+    {
+        /* keep the unfinished last line for the next feed */
+        size_t tail = length;
+        while (tail > position && bytes[tail - 1] != '\n')
+        {
+            tail--;
+        }
+        parser->stream_line_length = length - tail;
+        memcpy(parser->stream_line, bytes + tail,
+               parser->stream_line_length < STREAM_CARRY_SIZE ? parser->stream_line_length : STREAM_CARRY_SIZE);
+    }
+    return parser->stream_result;
+}
+
+/* Ends the stream and returns its result. An unfinished last line never
+matches, just like with `searchFileForKeywords`. Afterwards, the parser
+can be used for a new stream. */
+int parserFinish(FileParser *parser)
+{
+    if (parser == NULL)
+    {
+        return ERROR;
+    }
+    int return_value = parser->stream_result;
+    parser->stream_result = NO_KEYWORD_FOUND;
+    parser->stream_line_length = 0;
+    return return_value;
+}
+
+/* Searches everything that can be read from `fd` (for example, a pipe or a
+socket) with constant memory. Stops reading as soon as a keyword is found. */
+int parseDescriptor(int fd)
+{
+    int return_value = ERROR;
+    FileParser *parser = createStreamParser();
+    if (parser)
+    {
+        ssize_t read_bytes;
+        while ((read_bytes = read(fd, parser->buffer, STREAM_READ_SIZE)) != 0)
+        {
+            if (read_bytes == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                parser->stream_result = ERROR;
+                break;
+            }
+            if (parserFeed(parser, parser->buffer, read_bytes) != NO_KEYWORD_FOUND)
+            {
+                break;
+            }
+        }
+        return_value = parserFinish(parser);
+    }
+    cleanupParser(parser);
+    return return_value;
+}
+
 void cleanupParser(FileParser *parser)
 {
     if (parser)
@@ -70,6 +1031,11 @@ void cleanupParser(FileParser *parser)
         {
             fclose(parser->file_pointer);
         }
+        if (parser->mapped_data)
+        {
+            munmap((void *)parser->mapped_data, parser->mapped_size);
+        }
+        cleanupKeywordMatcher(parser->matcher);
         free(parser);
     }
-}
\ No newline at end of file
+}
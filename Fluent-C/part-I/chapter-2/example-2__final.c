@@ -1,5 +1,18 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* max. size of string parameters (including NULL-termination) */
 #define STRING_SIZE 100
@@ -8,7 +21,10 @@
 typedef enum
 {
     OK,
-    CANNOT_ADD_KEY
+    CANNOT_ADD_KEY,
+    KEY_NOT_FOUND,
+    CANNOT_ACCESS_FILE,
+    INVALID_IMAGE
 } RegError;
 
 /* Handle for registry keys */
@@ -20,20 +36,98 @@ to the key or `NULL` on error. */
 RegKey createKey(char *key_name);
 
 /* Store the provided `value` (must not be `NULL`, max. `STRING_SIZE` characters)
-to the `key` (MUST NOT BE `NULL`) */
+to the `key` (MUST NOT BE `NULL`). Readers see either the old or the new value. */
 void storeValue(RegKey key, char *value);
 
 /* Make the `key` (must not be `NULL`) available for being read.
 Returns `OK` if no problem occurs or `CANNOT_ADD_KEY` if the
-registry is full and no more keys can be published. */
+registry cannot grow any further or another key with the same name
+is already published. */
 RegError publishKey(RegKey key);
 
+/* Returns the published key identified via the provided `key_name`
+(must not be `NULL`) or `NULL` if no such key is published. Keys
+published at runtime take precedence over keys of a loaded image.
+Can be called from any number of threads and never takes a lock. */
+RegKey findKey(char *key_name);
+
+/* Copies the value of the `key` (must not be `NULL`) into the provided
+`value` buffer (must not be `NULL`, min. `STRING_SIZE` characters). */
+void readValue(RegKey key, char *value);
+
+/* Makes the `key` (must not be `NULL`) unavailable for being read.
+Returns `OK` if no problem occurs or `KEY_NOT_FOUND` if the `key`
+is not published. Readers may still hold the handle obtained by `findKey`,
+so the key must stay valid as long as they can use it. */
+RegError unpublishKey(RegKey key);
+
+/* Returns the memory of the `key` (must not be `NULL` and must not be
+published) to the registry's key allocator. */
+void destroyKey(RegKey key);
+
+/* Releases all keys, values and the index of the registry at once. No
+other thread may use the registry or any of its keys during and after
+this call. */
+void registryDestroy();
+
+/* Writes all published keys and their values together with a hash index
+into an image file at `path` (must not be `NULL`), which `registryLoad`
+can map without parsing. The file is replaced atomically. Returns `OK`,
+`CANNOT_ACCESS_FILE` if the file cannot be written, or `CANNOT_ADD_KEY`
+in case of insufficient memory. */
+RegError registrySave(char *path);
+
+/* Maps the image file at `path` (must not be `NULL`) written by `registrySave`
+read-only and serves its keys from the mapping, replacing a previously loaded
+image. Handles of replaced image keys stay readable until `registryDestroy`.
+Keys of an image cannot be modified with `storeValue` or unpublished.
+Returns `OK`, `CANNOT_ACCESS_FILE` if the file cannot be mapped, or
+`INVALID_IMAGE` if it is not a compatible registry image. */
+RegError registryLoad(char *path);
+
+/* Handle for a set of keys that are published together */
+typedef struct Batch *RegBatch;
+
+/* Creates an empty batch. Returns a handle to the batch or `NULL` on error. */
+RegBatch createBatch();
+
+/* Stages a key named `key_name` with the provided `value` (both must not be
+`NULL`, max. `STRING_SIZE` characters) in the `batch` (must not be `NULL`).
+Returns `OK` or `CANNOT_ADD_KEY` in case of insufficient memory. */
+RegError batchAddKey(RegBatch batch, char *key_name, char *value);
+
+/* Publishes all keys of the `batch` (must not be `NULL`) at once: readers
+see either none or all of them. A staged key replaces a published key with
+the same name (the replaced key is not destroyed). Returns `OK`, or
+`CANNOT_ADD_KEY` if the batch names a key twice or the registry cannot grow
+any further, in which case nothing is published. The batch is empty again
+afterwards either way. */
+RegError publishBatch(RegBatch batch);
+
+/* Releases the `batch` without publishing the keys staged in it */
+void destroyBatch(RegBatch batch);
+
 ////////// Registry implementation //////////
-#define MAX_KEYS 40
+/* number of index slots the registry starts with (power of two) */
+#define INITIAL_INDEX_SIZE 64
+/* values up to this length are stored inside the key itself; they are
+copied word by word, so that readers racing with a writer only ever read
+atomic objects */
+#define INLINE_VALUE_WORDS 2
+#define INLINE_VALUE_SIZE (INLINE_VALUE_WORDS * sizeof(uint64_t))
+/* Keys are variable-sized records: the name is stored right behind the
+header, short values inline, and longer values in the value arena. */
 struct Key
 {
-    char key_name[STRING_SIZE];
-    char key_value[STRING_SIZE];
+    /* sequence lock of the value: odd while a writer is updating it */
+    atomic_uint value_sequence;
+    atomic_uint value_length; /* only valid for inline values */
+    /* distance from the key to its value record (length byte followed by
+    the characters) or 0 if the value is stored inline; being relative, it
+    stays valid when a key is part of a mapped image */
+    atomic_int_least64_t value_offset;
+    atomic_uint_least64_t value_inline[INLINE_VALUE_WORDS];
+    char key_name[];
 };
 
 /* macro to log debug info and to assert */
@@ -45,14 +139,437 @@ struct Key
         assert(false);                        \
     }
 
-/* file-global array holding all registry keys */
-static struct Key *key_list[MAX_KEYS];
+/* One slot of the open-addressing hash index over the published keys.
+The hash is cached so that probing rarely has to compare names. A reader
+only sees the key if the visible generation it started with lies within
+[`visible_from`, `visible_until`), which lets a batch appear at once. */
+struct IndexSlot
+{
+    _Atomic(struct Key *) key;
+    atomic_uint_least64_t hash;
+    atomic_uint_least64_t visible_from;
+    atomic_uint_least64_t visible_until;
+};
+
+/* The hash index is only ever extended in place (empty or unpublished slots
+get filled). Anything else builds a new index that replaces the old one
+atomically, so readers can probe without any lock. */
+struct KeyIndex
+{
+    size_t size; /* number of slots (power of two) */
+    size_t used; /* slots holding a key or a tombstone */
+    struct IndexSlot slots[];
+};
+
+/* marks slots of unpublished keys, so that probe sequences stay intact */
+static struct Key tombstone;
+#define TOMBSTONE (&tombstone)
+
+/* A registry image mapped by `registryLoad`. Handles to its keys may be
+kept indefinitely, so a replaced image stays mapped until `registryDestroy`
+and is linked from the image that replaced it. */
+struct RegistryImage
+{
+    const unsigned char *data;
+    size_t size;
+    struct RegistryImage *previous;
+};
+
+/* image keys are served directly from this mapping */
+static _Atomic(struct RegistryImage *) registry_image;
+
+/* file-global hash index holding all published registry keys */
+static _Atomic(struct KeyIndex *) key_index;
+/* generation of the latest published batch; slots of a batch that is still
+being inserted belong to the next generation */
+static atomic_uint_least64_t visible_generation;
+static size_t published_keys;
+/* serializes all writers; readers never touch it */
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Per-thread reader state of the epoch-based reclamation. Readers announce
+the epoch in which they started reading, so that a writer knows when an
+old index is no longer used by anyone. */
+struct ReaderState
+{
+    _Alignas(64) atomic_uint_least64_t epoch; /* 0 while not reading */
+    struct ReaderState *next;
+};
+
+static atomic_uint_least64_t global_epoch = 1;
+/* protects the membership of `reader_list`, not the epochs stored in it */
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ReaderState *reader_list;
+static _Thread_local struct ReaderState *reader_state;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+
+/* Thread-exit destructor: unlinks and frees the reader state of the thread */
+static void unregisterReader(void *state)
+{
+    pthread_mutex_lock(&reader_mutex);
+    struct ReaderState **link = &reader_list;
+    while (*link != state)
+    {
+        link = &(*link)->next;
+    }
+    *link = ((struct ReaderState *)state)->next;
+    pthread_mutex_unlock(&reader_mutex);
+    free(state);
+    reader_state = NULL;
+}
+
+static void createReaderKey()
+{
+    logAssert(pthread_key_create(&reader_key, unregisterReader) == 0)
+}
+
+/* Enters a read-side critical section; registers the calling thread on
+its first read, which is the only time a reader takes a lock */
+static void readLock()
+{
+    if (reader_state == NULL)
+    {
+        pthread_once(&reader_key_once, createReaderKey);
+        struct ReaderState *state = aligned_alloc(64, sizeof(struct ReaderState));
+        logAssert(state != NULL)
+        atomic_init(&state->epoch, 0);
+        pthread_mutex_lock(&reader_mutex);
+        state->next = reader_list;
+        reader_list = state;
+        pthread_mutex_unlock(&reader_mutex);
+        logAssert(pthread_setspecific(reader_key, state) == 0)
+        reader_state = state;
+    }
+    atomic_store(&reader_state->epoch, atomic_load(&global_epoch));
+}
+
+static void readUnlock()
+{
+    atomic_store_explicit(&reader_state->epoch, 0, memory_order_release);
+}
+
+/* Waits until every reader that might still see data replaced before this
+call has left its critical section */
+static void synchronizeReaders()
+{
+    uint64_t epoch = atomic_fetch_add(&global_epoch, 1) + 1;
+    /* a thread can only exit (and unregister) outside its critical section */
+    pthread_mutex_lock(&reader_mutex);
+    for (struct ReaderState *reader = reader_list; reader != NULL; reader = reader->next)
+    {
+        uint64_t reader_epoch;
+        while ((reader_epoch = atomic_load(&reader->epoch)) != 0 && reader_epoch < epoch)
+        {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&reader_mutex);
+}
+
+////////// Key allocator //////////
+
+/* key records are allocated in size classes of this granularity */
+#define KEY_SIZE_GRANULE 16
+#define KEY_CLASS_COUNT ((sizeof(struct Key) + STRING_SIZE + KEY_SIZE_GRANULE - 1) / KEY_SIZE_GRANULE)
+#define SLAB_SIZE (64 * 1024)
+/* number of keys moved between a thread cache and the shared free list at once */
+#define KEY_CACHE_BATCH 32
+#define VALUE_ARENA_BLOCK_SIZE (64 * 1024)
+/* value records are allocated in size classes of this granularity */
+#define VALUE_SIZE_GRANULE 16
+#define VALUE_CLASS_COUNT ((STRING_SIZE + VALUE_SIZE_GRANULE - 1) / VALUE_SIZE_GRANULE)
+/* replaced value records collected before a grace period makes them reusable */
+#define RETIRED_VALUE_LIMIT 256
+
+/* Slabs are carved into equally sized key records; free records are
+linked through their first bytes. */
+struct Slab
+{
+    struct Slab *next;
+    _Alignas(16) char records[];
+};
+
+struct FreeRecord
+{
+    struct FreeRecord *next;
+};
+
+/* Keys freed and allocated by a thread go through its own cache first, so
+that the shared free lists (and their lock) are only touched once per batch */
+struct KeyCache
+{
+    struct FreeRecord *free_list[KEY_CLASS_COUNT];
+    unsigned count[KEY_CLASS_COUNT];
+    uint64_t generation; /* caches of an older generation were destroyed */
+};
+
+/* Storage for values that do not fit into a key; records are carved off the
+newest block or reused from the free list of their size class */
+struct ValueArenaBlock
+{
+    struct ValueArenaBlock *next;
+    size_t used;
+    unsigned char data[];
+};
+
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct Slab *slab_list;
+static struct FreeRecord *shared_free_list[KEY_CLASS_COUNT];
+static uint64_t slab_generation = 1;
+static _Thread_local struct KeyCache key_cache;
+/* only used with `writer_mutex` held */
+static struct ValueArenaBlock *value_arena;
+static struct FreeRecord *free_values[VALUE_CLASS_COUNT];
+static unsigned char *retired_values[RETIRED_VALUE_LIMIT];
+static size_t retired_value_count;
+
+static size_t keyClass(size_t name_length)
+{
+    return (sizeof(struct Key) + name_length + 1 + KEY_SIZE_GRANULE - 1) / KEY_SIZE_GRANULE - 1;
+}
+
+/* Moves up to `KEY_CACHE_BATCH` records of `key_class` from the shared free
+list (refilled from a new slab if needed) into the thread cache */
+static void refillKeyCache(size_t key_class)
+{
+    size_t record_size = (key_class + 1) * KEY_SIZE_GRANULE;
+    pthread_mutex_lock(&slab_mutex);
+    if (key_cache.generation != slab_generation)
+    {
+        memset(&key_cache, 0, sizeof(key_cache));
+        key_cache.generation = slab_generation;
+    }
+    if (shared_free_list[key_class] == NULL)
+    {
+        struct Slab *slab = malloc(SLAB_SIZE);
+        if (slab != NULL)
+        {
+            slab->next = slab_list;
+            slab_list = slab;
+            size_t record_count = (SLAB_SIZE - offsetof(struct Slab, records)) / record_size;
+            for (size_t i = 0; i < record_count; i++)
+            {
+                struct FreeRecord *record = (struct FreeRecord *)(slab->records + i * record_size);
+                record->next = shared_free_list[key_class];
+                shared_free_list[key_class] = record;
+            }
+        }
+    }
+    while (shared_free_list[key_class] != NULL && key_cache.count[key_class] < KEY_CACHE_BATCH)
+    {
+        struct FreeRecord *record = shared_free_list[key_class];
+        shared_free_list[key_class] = record->next;
+        record->next = key_cache.free_list[key_class];
+        key_cache.free_list[key_class] = record;
+        key_cache.count[key_class]++;
+    }
+    pthread_mutex_unlock(&slab_mutex);
+}
+
+/* Returns a zeroed record for a key whose name has `name_length` characters
+or `NULL` in case of insufficient memory */
+static struct Key *allocateKey(size_t name_length)
+{
+    size_t key_class = keyClass(name_length);
+    /* the generation is read without the lock: it only changes in
+    `registryDestroy`, which must not run concurrently */
+    if (key_cache.generation != slab_generation || key_cache.free_list[key_class] == NULL)
+    {
+        refillKeyCache(key_class);
+    }
+    struct FreeRecord *record = key_cache.free_list[key_class];
+    if (record == NULL)
+    {
+        return NULL;
+    }
+    key_cache.free_list[key_class] = record->next;
+    key_cache.count[key_class]--;
+    memset(record, 0, (key_class + 1) * KEY_SIZE_GRANULE);
+    return (struct Key *)record;
+}
+
+static void freeKey(struct Key *key)
+{
+    size_t key_class = keyClass(strlen(key->key_name));
+    struct FreeRecord *record = (struct FreeRecord *)key;
+    if (key_cache.generation != slab_generation)
+    {
+        memset(&key_cache, 0, sizeof(key_cache));
+        key_cache.generation = slab_generation;
+    }
+    record->next = key_cache.free_list[key_class];
+    key_cache.free_list[key_class] = record;
+    if (++key_cache.count[key_class] > 2 * KEY_CACHE_BATCH)
+    {
+        /* hand a batch back, so that other threads can reuse it */
+        pthread_mutex_lock(&slab_mutex);
+        for (int i = 0; i < KEY_CACHE_BATCH; i++)
+        {
+            record = key_cache.free_list[key_class];
+            key_cache.free_list[key_class] = record->next;
+            record->next = shared_free_list[key_class];
+            shared_free_list[key_class] = record;
+        }
+        key_cache.count[key_class] -= KEY_CACHE_BATCH;
+        pthread_mutex_unlock(&slab_mutex);
+    }
+}
+
+static size_t valueClass(size_t length)
+{
+    return (length + 1 + VALUE_SIZE_GRANULE - 1) / VALUE_SIZE_GRANULE - 1;
+}
+
+/* Copies `length` characters of `value` into the value arena (`writer_mutex`
+must be held). Returns `NULL` in case of insufficient memory. */
+static const unsigned char *storeArenaValue(const char *value, size_t length)
+{
+    size_t value_class = valueClass(length);
+    size_t record_size = (value_class + 1) * VALUE_SIZE_GRANULE;
+    unsigned char *record = (unsigned char *)free_values[value_class];
+    if (record != NULL)
+    {
+        free_values[value_class] = free_values[value_class]->next;
+    }
+    else
+    {
+        if (value_arena == NULL || value_arena->used + record_size > VALUE_ARENA_BLOCK_SIZE)
+        {
+            struct ValueArenaBlock *block = malloc(sizeof(struct ValueArenaBlock) + VALUE_ARENA_BLOCK_SIZE);
+            if (block == NULL)
+            {
+                return NULL;
+            }
+            block->next = value_arena;
+            block->used = 0;
+            value_arena = block;
+        }
+        record = value_arena->data + value_arena->used;
+        value_arena->used += record_size;
+    }
+    record[0] = (unsigned char)length;
+    memcpy(record + 1, value, length);
+    return record;
+}
+
+/* Returns all retired value records to their free lists once no reader can
+still be copying them (`writer_mutex` must be held) */
+static void reclaimRetiredValues()
+{
+    synchronizeReaders();
+    for (size_t i = 0; i < retired_value_count; i++)
+    {
+        struct FreeRecord *record = (struct FreeRecord *)retired_values[i];
+        size_t value_class = valueClass(retired_values[i][0]);
+        record->next = free_values[value_class];
+        free_values[value_class] = record;
+    }
+    retired_value_count = 0;
+}
+
+/* Hands back the arena record of a replaced value (`writer_mutex` must be
+held). Readers that loaded its offset before may still copy it, so records
+are only reused after a grace period, which is waited for once per
+`RETIRED_VALUE_LIMIT` records. */
+static void retireArenaValue(unsigned char *record)
+{
+    if (retired_value_count == RETIRED_VALUE_LIMIT)
+    {
+        reclaimRetiredValues();
+    }
+    retired_values[retired_value_count++] = record;
+}
+
+/* FNV-1a hash of a key name */
+static uint64_t hashKeyName(const char *key_name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *key_name != '\0'; key_name++)
+    {
+        hash ^= (unsigned char)*key_name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Writer-side lookup: returns the slot holding the key named `key_name` or,
+if there is none, the first reusable slot of its probe sequence (a tombstone
+or an empty slot). The index must not be full. */
+static struct IndexSlot *findIndexSlot(struct KeyIndex *index, const char *key_name, uint64_t hash)
+{
+    struct IndexSlot *reusable = NULL;
+    size_t mask = index->size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct Key *key = atomic_load_explicit(&index->slots[i].key, memory_order_relaxed);
+        if (key == NULL)
+        {
+            return reusable ? reusable : &index->slots[i];
+        }
+        if (key == TOMBSTONE)
+        {
+            if (reusable == NULL)
+            {
+                reusable = &index->slots[i];
+            }
+        }
+        else if (atomic_load_explicit(&index->slots[i].hash, memory_order_relaxed) == hash &&
+                 strcmp(key->key_name, key_name) == 0)
+        {
+            return &index->slots[i];
+        }
+    }
+}
+
+/* Fills the slot with `key`, visible from generation `visible_from` on. The
+other fields are stored first, so that a reader seeing the key also sees them. */
+static void fillIndexSlot(struct IndexSlot *slot, struct Key *key, uint64_t hash, uint64_t visible_from)
+{
+    atomic_store_explicit(&slot->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&slot->visible_from, visible_from, memory_order_relaxed);
+    atomic_store_explicit(&slot->visible_until, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&slot->key, key, memory_order_release);
+}
+
+/* Builds a new index large enough for `key_count` keys without tombstones,
+replaces the current one and frees the old one once no reader uses it anymore.
+Returns `false` in case of insufficient memory. */
+static bool rebuildIndex(size_t key_count)
+{
+    struct KeyIndex *old_index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    size_t new_size = INITIAL_INDEX_SIZE;
+    while (new_size < key_count * 2)
+    {
+        new_size *= 2;
+    }
+    struct KeyIndex *new_index = calloc(1, sizeof(struct KeyIndex) + new_size * sizeof(struct IndexSlot));
+    if (new_index == NULL)
+    {
+        return false;
+    }
+    new_index->size = new_size;
+    for (size_t i = 0; old_index != NULL && i < old_index->size; i++)
+    {
+        struct Key *key = atomic_load_explicit(&old_index->slots[i].key, memory_order_relaxed);
+        if (key != NULL && key != TOMBSTONE)
+        {
+            uint64_t hash = atomic_load_explicit(&old_index->slots[i].hash, memory_order_relaxed);
+            fillIndexSlot(findIndexSlot(new_index, key->key_name, hash), key, hash, 0);
+            new_index->used++;
+        }
+    }
+    atomic_store(&key_index, new_index);
+    synchronizeReaders();
+    free(old_index);
+    return true;
+}
 
 RegKey createKey(char *key_name)
 {
     logAssert(key_name != NULL)
         logAssert(STRING_SIZE > strlen(key_name))
-            RegKey newKey = calloc(1, sizeof(struct Key));
+            RegKey newKey = allocateKey(strlen(key_name));
     if (newKey == NULL)
     {
         return NULL;
@@ -61,23 +578,935 @@ RegKey createKey(char *key_name)
     return newKey;
 }
 
+/* Stores `length` characters of `value` into the `key` (`writer_mutex` must
+be held). Returns `false` and leaves the key unchanged in case of insufficient
+memory. */
+static bool writeValue(struct Key *key, const char *value, size_t length)
+{
+    uint64_t words[INLINE_VALUE_WORDS] = {0};
+    const unsigned char *data = NULL;
+    if (length > INLINE_VALUE_SIZE)
+    {
+        data = storeArenaValue(value, length);
+        if (data == NULL)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        memcpy(words, value, length);
+    }
+    unsigned sequence = atomic_load_explicit(&key->value_sequence, memory_order_relaxed);
+    atomic_store_explicit(&key->value_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&key->value_length, (unsigned)length, memory_order_relaxed);
+    for (size_t i = 0; i < INLINE_VALUE_WORDS; i++)
+    {
+        atomic_store_explicit(&key->value_inline[i], words[i], memory_order_relaxed);
+    }
+    int64_t old_offset = atomic_load_explicit(&key->value_offset, memory_order_relaxed);
+    atomic_store_explicit(&key->value_offset, data ? (intptr_t)data - (intptr_t)key : 0, memory_order_release);
+    atomic_store_explicit(&key->value_sequence, sequence + 2, memory_order_release);
+    if (old_offset != 0)
+    {
+        retireArenaValue((unsigned char *)key + old_offset);
+    }
+    return true;
+}
+
 void storeValue(RegKey key, char *value)
 {
     logAssert(key != NULL && value != NULL)
-        logAssert(STRING_SIZE > strlen(value))
-            strcpy(key->key_value, value);
+    logAssert(STRING_SIZE > strlen(value))
+    pthread_mutex_lock(&writer_mutex);
+    bool written = writeValue(key, value, strlen(value));
+    pthread_mutex_unlock(&writer_mutex);
+    logAssert(written)
 }
 
 RegError publishKey(RegKey key)
 {
-    logAssert(key != NULL) int i;
-    for (i = 0; i < MAX_KEYS; i++)
+    logAssert(key != NULL)
+    RegError return_value = OK;
+    uint64_t hash = hashKeyName(key->key_name);
+    pthread_mutex_lock(&writer_mutex);
+    struct KeyIndex *index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    /* keep keys and tombstones below 3/4 of the slots, so that probe
+    sequences stay short and always end in an empty slot */
+    if ((index == NULL || (index->used + 1) * 4 > index->size * 3))
+    {
+        if (!rebuildIndex(published_keys + 1))
+        {
+            return_value = CANNOT_ADD_KEY;
+            goto unlock;
+        }
+        index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    }
+    struct IndexSlot *slot = findIndexSlot(index, key->key_name, hash);
+    struct Key *slot_key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+    if (slot_key != NULL && slot_key != TOMBSTONE)
+    {
+        return_value = slot_key == key ? OK : CANNOT_ADD_KEY;
+        goto unlock;
+    }
+    if (slot_key == NULL)
+    {
+        index->used++;
+    }
+    fillIndexSlot(slot, key, hash, 0);
+    published_keys++;
+unlock:
+    pthread_mutex_unlock(&writer_mutex);
+    return return_value;
+}
+
+/* Returns the key named `key_name` that is visible in `generation` */
+static struct Key *findPublishedKey(struct KeyIndex *index, const char *key_name, uint64_t hash,
+                                    uint64_t generation)
+{
+    size_t mask = index->size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct IndexSlot *slot = &index->slots[i];
+        struct Key *key = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (key == NULL)
+        {
+            return NULL;
+        }
+        if (key != TOMBSTONE &&
+            atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash &&
+            atomic_load_explicit(&slot->visible_from, memory_order_relaxed) <= generation &&
+            atomic_load_explicit(&slot->visible_until, memory_order_relaxed) > generation &&
+            strcmp(key->key_name, key_name) == 0)
+        {
+            return key;
+        }
+    }
+}
+
+static struct Key *findImageKey(struct RegistryImage *image, const char *key_name, uint64_t hash);
+
+RegKey findKey(char *key_name)
+{
+    logAssert(key_name != NULL)
+    struct Key *found = NULL;
+    uint64_t hash = hashKeyName(key_name);
+    readLock();
+    uint64_t generation = atomic_load_explicit(&visible_generation, memory_order_acquire);
+    struct KeyIndex *index = atomic_load(&key_index);
+    struct RegistryImage *image = atomic_load(&registry_image);
+    if (index != NULL)
+    {
+        found = findPublishedKey(index, key_name, hash, generation);
+    }
+    if (found == NULL && image != NULL)
+    {
+        found = findImageKey(image, key_name, hash);
+    }
+    readUnlock();
+    return found;
+}
+
+void readValue(RegKey key, char *value)
+{
+    logAssert(key != NULL && value != NULL)
+    unsigned sequence;
+    size_t length;
+    /* the read section keeps a replaced arena record from being reused */
+    readLock();
+    /* retry if a writer updated the value while it was copied */
+    do
+    {
+        while ((sequence = atomic_load_explicit(&key->value_sequence, memory_order_acquire)) & 1)
+        {
+            sched_yield();
+        }
+        int64_t offset = atomic_load_explicit(&key->value_offset, memory_order_acquire);
+        if (offset != 0)
+        {
+            const unsigned char *data = (const unsigned char *)key + offset;
+            /* the length is part of the arena record, which is not reused
+            while this thread is inside its read section */
+            length = data[0];
+            memcpy(value, data + 1, length);
+        }
+        else
+        {
+            uint64_t words[INLINE_VALUE_WORDS];
+            for (size_t i = 0; i < INLINE_VALUE_WORDS; i++)
+            {
+                words[i] = atomic_load_explicit(&key->value_inline[i], memory_order_relaxed);
+            }
+            length = atomic_load_explicit(&key->value_length, memory_order_relaxed);
+            if (length > INLINE_VALUE_SIZE)
+            {
+                length = INLINE_VALUE_SIZE;
+            }
+            memcpy(value, words, length);
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&key->value_sequence, memory_order_relaxed) != sequence);
+    readUnlock();
+    value[length] = '\0';
+}
+
+RegError unpublishKey(RegKey key)
+{
+    logAssert(key != NULL)
+    RegError return_value = KEY_NOT_FOUND;
+    pthread_mutex_lock(&writer_mutex);
+    struct KeyIndex *index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    if (index != NULL)
+    {
+        struct IndexSlot *slot = findIndexSlot(index, key->key_name, hashKeyName(key->key_name));
+        if (atomic_load_explicit(&slot->key, memory_order_relaxed) == key)
+        {
+            atomic_store_explicit(&slot->key, TOMBSTONE, memory_order_release);
+            published_keys--;
+            return_value = OK;
+        }
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return return_value;
+}
+
+/* Returns the key record together with its value record, if any
+(`writer_mutex` must be held) */
+static void releaseKey(struct Key *key)
+{
+    int64_t offset = atomic_load_explicit(&key->value_offset, memory_order_relaxed);
+    if (offset != 0)
+    {
+        retireArenaValue((unsigned char *)key + offset);
+    }
+    freeKey(key);
+}
+
+void destroyKey(RegKey key)
+{
+    logAssert(key != NULL)
+    pthread_mutex_lock(&writer_mutex);
+    releaseKey(key);
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+static void unmapRegistryImage(struct RegistryImage *image);
+
+void registryDestroy()
+{
+    pthread_mutex_lock(&writer_mutex);
+    free(atomic_load(&key_index));
+    atomic_store(&key_index, NULL);
+    unmapRegistryImage(atomic_load(&registry_image));
+    atomic_store(&registry_image, NULL);
+    published_keys = 0;
+    while (value_arena != NULL)
     {
-        if (key_list[i] == NULL)
+        struct ValueArenaBlock *next = value_arena->next;
+        free(value_arena);
+        value_arena = next;
+    }
+    memset(free_values, 0, sizeof(free_values));
+    retired_value_count = 0;
+    pthread_mutex_unlock(&writer_mutex);
+
+    pthread_mutex_lock(&slab_mutex);
+    while (slab_list != NULL)
+    {
+        struct Slab *next = slab_list->next;
+        free(slab_list);
+        slab_list = next;
+    }
+    memset(shared_free_list, 0, sizeof(shared_free_list));
+    /* invalidates the caches of all threads at once */
+    slab_generation++;
+    pthread_mutex_unlock(&slab_mutex);
+}
+
+////////// Batch publishing //////////
+
+#define INITIAL_BATCH_SIZE 4096
+
+/* Staged keys are stored back to back as name and value strings */
+struct Batch
+{
+    char *buffer;
+    size_t used;
+    size_t size;
+    size_t key_count;
+};
+
+/* Bookkeeping of one staged key while its batch is being published */
+struct BatchEntry
+{
+    struct Key *key;
+    uint64_t hash;
+    const char *value;
+    size_t value_length;
+    struct IndexSlot *slot;
+    struct IndexSlot *replaced_slot;
+};
+
+RegBatch createBatch()
+{
+    RegBatch batch = calloc(1, sizeof(struct Batch));
+    if (batch == NULL)
+    {
+        return NULL;
+    }
+    batch->buffer = malloc(INITIAL_BATCH_SIZE);
+    if (batch->buffer == NULL)
+    {
+        free(batch);
+        return NULL;
+    }
+    batch->size = INITIAL_BATCH_SIZE;
+    return batch;
+}
+
+RegError batchAddKey(RegBatch batch, char *key_name, char *value)
+{
+    logAssert(batch != NULL && key_name != NULL && value != NULL)
+    /* Reserving room for the longest strings lets each string be copied in
+    one pass with its length checked by `memccpy` */
+    if (batch->used + 2 * STRING_SIZE > batch->size)
+    {
+        size_t new_size = batch->size * 2 + 2 * STRING_SIZE;
+        char *buffer = realloc(batch->buffer, new_size);
+        if (buffer == NULL)
+        {
+            return CANNOT_ADD_KEY;
+        }
+        batch->buffer = buffer;
+        batch->size = new_size;
+    }
+    char *name_end = memccpy(batch->buffer + batch->used, key_name, '\0', STRING_SIZE);
+    logAssert(name_end != NULL)
+    char *value_end = memccpy(name_end, value, '\0', STRING_SIZE);
+    logAssert(value_end != NULL)
+    batch->used = value_end - batch->buffer;
+    batch->key_count++;
+    return OK;
+}
+
+/* Writer-side lookup for a batch of `generation`: stores the slot of the
+currently published key named `key_name` (or `NULL`) into `replaced_slot`.
+Returns the first reusable slot of the probe sequence, or `NULL` if the
+batch already contains this name. */
+static struct IndexSlot *findBatchSlot(struct KeyIndex *index, const char *key_name, uint64_t hash,
+                                       uint64_t generation, struct IndexSlot **replaced_slot)
+{
+    struct IndexSlot *reusable = NULL;
+    size_t mask = index->size - 1;
+    *replaced_slot = NULL;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        struct IndexSlot *slot = &index->slots[i];
+        struct Key *key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+        if (key == NULL)
+        {
+            return reusable ? reusable : slot;
+        }
+        if (key == TOMBSTONE)
+        {
+            if (reusable == NULL)
+            {
+                reusable = slot;
+            }
+        }
+        else if (atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash &&
+                 strcmp(key->key_name, key_name) == 0)
+        {
+            if (atomic_load_explicit(&slot->visible_from, memory_order_relaxed) == generation)
+            {
+                return NULL;
+            }
+            *replaced_slot = slot;
+        }
+    }
+}
+
+/* Removes the first `count` of the `key_count` entries of a failed batch
+from the index again and releases the keys of all entries. None of them
+has ever been visible, so no reader can be using them. */
+static void rollbackBatch(struct BatchEntry *entries, size_t count, size_t key_count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        atomic_store_explicit(&entries[i].slot->key, TOMBSTONE, memory_order_relaxed);
+        releaseKey(entries[i].key);
+        if (entries[i].replaced_slot != NULL)
+        {
+            atomic_store_explicit(&entries[i].replaced_slot->visible_until, UINT64_MAX, memory_order_relaxed);
+        }
+    }
+    for (size_t i = count; i < key_count; i++)
+    {
+        freeKey(entries[i].key);
+    }
+}
+
+RegError publishBatch(RegBatch batch)
+{
+    logAssert(batch != NULL)
+    RegError return_value = OK;
+    size_t count = 0;
+    struct BatchEntry *entries = malloc((batch->key_count ? batch->key_count : 1) * sizeof(struct BatchEntry));
+    if (entries == NULL)
+    {
+        batch->used = 0;
+        batch->key_count = 0;
+        return CANNOT_ADD_KEY;
+    }
+    /* everything that does not touch the index or the value arena is done
+    before taking the lock, so that concurrent publishers wait less */
+    for (char *name = batch->buffer; count < batch->key_count; count++)
+    {
+        size_t name_length = strlen(name);
+        entries[count].value = name + name_length + 1;
+        entries[count].value_length = strlen(entries[count].value);
+        entries[count].hash = hashKeyName(name);
+        entries[count].key = allocateKey(name_length);
+        if (entries[count].key == NULL)
+        {
+            while (count > 0)
+            {
+                freeKey(entries[--count].key);
+            }
+            free(entries);
+            batch->used = 0;
+            batch->key_count = 0;
+            return CANNOT_ADD_KEY;
+        }
+        memcpy(entries[count].key->key_name, name, name_length + 1);
+        name = (char *)entries[count].value + entries[count].value_length + 1;
+    }
+    count = 0;
+    pthread_mutex_lock(&writer_mutex);
+    uint64_t generation = atomic_load_explicit(&visible_generation, memory_order_relaxed) + 1;
+    struct KeyIndex *index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    /* make room for the whole batch up front, so that the index is not
+    rebuilt while some of its slots are still invisible */
+    if (index == NULL || (index->used + batch->key_count + 1) * 4 > index->size * 3)
+    {
+        if (!rebuildIndex(published_keys + batch->key_count))
+        {
+            rollbackBatch(entries, 0, batch->key_count);
+            return_value = CANNOT_ADD_KEY;
+            goto unlock;
+        }
+        index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    }
+    for (; count < batch->key_count; count++)
+    {
+        struct BatchEntry *entry = &entries[count];
+        struct IndexSlot *slot =
+            findBatchSlot(index, entry->key->key_name, entry->hash, generation, &entry->replaced_slot);
+        if (slot == NULL || !writeValue(entry->key, entry->value, entry->value_length))
+        {
+            rollbackBatch(entries, count, batch->key_count);
+            return_value = CANNOT_ADD_KEY;
+            goto unlock;
+        }
+        if (atomic_load_explicit(&slot->key, memory_order_relaxed) == NULL)
+        {
+            index->used++;
+        }
+        fillIndexSlot(slot, entry->key, entry->hash, generation);
+        entry->slot = slot;
+        if (entry->replaced_slot != NULL)
+        {
+            atomic_store_explicit(&entry->replaced_slot->visible_until, generation, memory_order_relaxed);
+        }
+    }
+    /* the single visibility point of the whole batch */
+    atomic_store_explicit(&visible_generation, generation, memory_order_release);
+    size_t replaced_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        replaced_count += entries[i].replaced_slot != NULL;
+    }
+    published_keys += count - replaced_count;
+    if (replaced_count > 0)
+    {
+        /* readers of the previous generation may still find replaced keys */
+        synchronizeReaders();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (entries[i].replaced_slot != NULL)
+            {
+                atomic_store_explicit(&entries[i].replaced_slot->key, TOMBSTONE, memory_order_release);
+            }
+        }
+    }
+unlock:
+    pthread_mutex_unlock(&writer_mutex);
+    free(entries);
+    batch->used = 0;
+    batch->key_count = 0;
+    return return_value;
+}
+
+void destroyBatch(RegBatch batch)
+{
+    if (batch)
+    {
+        free(batch->buffer);
+        free(batch);
+    }
+}
+
+////////// Registry image //////////
+
+/* The image consists of a header, the hash index and the key records.
+Index slots and values refer to records by offsets, so the image works
+at any address. All numbers are stored in native byte order. */
+#define REGISTRY_IMAGE_MAGIC "REGIMAGE"
+#define REGISTRY_IMAGE_VERSION 1
+#define IMAGE_RECORD_ALIGNMENT 16
+
+struct ImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;      /* 0x01020304 as written by the saving machine */
+    uint32_t key_header_size; /* `sizeof(struct Key)` of the saving build */
+    uint32_t inline_value_size;
+    uint64_t key_count;
+    uint64_t index_size;      /* number of slots (power of two) */
+    uint64_t index_offset;
+    uint64_t image_size;
+};
+
+struct ImageSlot
+{
+    uint64_t hash;
+    uint64_t record_offset; /* 0 for empty slots */
+};
+
+static struct Key *findImageKey(struct RegistryImage *image, const char *key_name, uint64_t hash)
+{
+    const struct ImageHeader *header = (const struct ImageHeader *)image->data;
+    const struct ImageSlot *slots = (const struct ImageSlot *)(image->data + header->index_offset);
+    size_t mask = header->index_size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        if (slots[i].record_offset == 0)
+        {
+            return NULL;
+        }
+        struct Key *key = (struct Key *)(image->data + slots[i].record_offset);
+        if (slots[i].hash == hash && strcmp(key->key_name, key_name) == 0)
+        {
+            return key;
+        }
+    }
+}
+
+/* Unmaps the `image` together with all images it replaced */
+static void unmapRegistryImage(struct RegistryImage *image)
+{
+    while (image)
+    {
+        struct RegistryImage *previous = image->previous;
+        munmap((void *)image->data, image->size);
+        free(image);
+        image = previous;
+    }
+}
+
+static size_t imageRecordSize(struct Key *key, size_t value_length)
+{
+    size_t size = sizeof(struct Key) + strlen(key->key_name) + 1;
+    if (value_length > INLINE_VALUE_SIZE)
+    {
+        size += value_length + 1;
+    }
+    return (size + IMAGE_RECORD_ALIGNMENT - 1) & ~(size_t)(IMAGE_RECORD_ALIGNMENT - 1);
+}
+
+/* Calls `visit` for every published key, including the keys of a loaded
+image that are not shadowed by a runtime key (`writer_mutex` must be held) */
+static void forEachPublishedKey(void (*visit)(struct Key *key, void *context), void *context)
+{
+    struct KeyIndex *index = atomic_load_explicit(&key_index, memory_order_relaxed);
+    struct RegistryImage *image = atomic_load_explicit(&registry_image, memory_order_relaxed);
+    for (size_t i = 0; index != NULL && i < index->size; i++)
+    {
+        struct Key *key = atomic_load_explicit(&index->slots[i].key, memory_order_relaxed);
+        if (key != NULL && key != TOMBSTONE)
         {
-            key_list[i] = key;
-            return OK;
+            visit(key, context);
         }
     }
-    return CANNOT_ADD_KEY;
-}
\ No newline at end of file
+    if (image != NULL)
+    {
+        const struct ImageHeader *header = (const struct ImageHeader *)image->data;
+        const struct ImageSlot *slots = (const struct ImageSlot *)(image->data + header->index_offset);
+        for (size_t i = 0; i < header->index_size; i++)
+        {
+            if (slots[i].record_offset != 0)
+            {
+                struct Key *key = (struct Key *)(image->data + slots[i].record_offset);
+                if (index == NULL ||
+                    findPublishedKey(index, key->key_name, slots[i].hash, atomic_load(&visible_generation)) == NULL)
+                {
+                    visit(key, context);
+                }
+            }
+        }
+    }
+}
+
+/* Layout of the image while it is built in memory */
+struct ImageBuilder
+{
+    unsigned char *data;
+    struct ImageSlot *slots;
+    size_t key_count;
+    size_t records_size;
+    size_t next_record;
+    size_t index_size;
+};
+
+static void measureImageKey(struct Key *key, void *context)
+{
+    struct ImageBuilder *builder = context;
+    char value[STRING_SIZE];
+    readValue(key, value);
+    builder->key_count++;
+    builder->records_size += imageRecordSize(key, strlen(value));
+}
+
+static void writeImageKey(struct Key *key, void *context)
+{
+    struct ImageBuilder *builder = context;
+    char value[STRING_SIZE];
+    readValue(key, value);
+    size_t length = strlen(value);
+    size_t name_length = strlen(key->key_name);
+    struct Key *record = (struct Key *)(builder->data + builder->next_record);
+    uint64_t words[INLINE_VALUE_WORDS] = {0};
+    atomic_init(&record->value_sequence, 0);
+    atomic_init(&record->value_length, (unsigned)length);
+    atomic_init(&record->value_offset, 0);
+    memcpy(record->key_name, key->key_name, name_length + 1);
+    if (length > INLINE_VALUE_SIZE)
+    {
+        unsigned char *value_record = (unsigned char *)record->key_name + name_length + 1;
+        value_record[0] = (unsigned char)length;
+        memcpy(value_record + 1, value, length);
+        atomic_init(&record->value_offset, value_record - (unsigned char *)record);
+    }
+    else
+    {
+        memcpy(words, value, length);
+    }
+    for (size_t i = 0; i < INLINE_VALUE_WORDS; i++)
+    {
+        atomic_init(&record->value_inline[i], words[i]);
+    }
+    uint64_t hash = hashKeyName(key->key_name);
+    size_t mask = builder->index_size - 1;
+    size_t i = hash & mask;
+    while (builder->slots[i].record_offset != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    builder->slots[i].hash = hash;
+    builder->slots[i].record_offset = builder->next_record;
+    builder->next_record += imageRecordSize(key, length);
+}
+
+RegError registrySave(char *path)
+{
+    logAssert(path != NULL)
+    RegError return_value = OK;
+    struct ImageBuilder builder = {0};
+    char temporary_path[4096];
+    if (snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path) >= (int)sizeof(temporary_path))
+    {
+        return CANNOT_ACCESS_FILE;
+    }
+    pthread_mutex_lock(&writer_mutex);
+    forEachPublishedKey(measureImageKey, &builder);
+    builder.index_size = INITIAL_INDEX_SIZE;
+    while (builder.index_size < builder.key_count * 2)
+    {
+        builder.index_size *= 2;
+    }
+    size_t index_offset = (sizeof(struct ImageHeader) + IMAGE_RECORD_ALIGNMENT - 1) &
+                          ~(size_t)(IMAGE_RECORD_ALIGNMENT - 1);
+    size_t records_offset = index_offset + builder.index_size * sizeof(struct ImageSlot);
+    size_t image_size = records_offset + builder.records_size;
+    builder.data = calloc(1, image_size);
+    if (builder.data == NULL)
+    {
+        return_value = CANNOT_ADD_KEY;
+        goto unlock;
+    }
+    builder.slots = (struct ImageSlot *)(builder.data + index_offset);
+    builder.next_record = records_offset;
+    forEachPublishedKey(writeImageKey, &builder);
+    struct ImageHeader *header = (struct ImageHeader *)builder.data;
+    memcpy(header->magic, REGISTRY_IMAGE_MAGIC, sizeof(header->magic));
+    header->version = REGISTRY_IMAGE_VERSION;
+    header->byte_order = 0x01020304;
+    header->key_header_size = sizeof(struct Key);
+    header->inline_value_size = INLINE_VALUE_SIZE;
+    header->key_count = builder.key_count;
+    header->index_size = builder.index_size;
+    header->index_offset = index_offset;
+    header->image_size = image_size;
+
+    /* write to a temporary file and flush it to disk before renaming it,
+    so that a crash never leaves a truncated image behind */
+    FILE *file = fopen(temporary_path, "wb");
+    if (file == NULL)
+    {
+        return_value = CANNOT_ACCESS_FILE;
+        goto unlock;
+    }
+    bool written = fwrite(builder.data, 1, image_size, file) == image_size &&
+                   fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !written || rename(temporary_path, path) != 0)
+    {
+        remove(temporary_path);
+        return_value = CANNOT_ACCESS_FILE;
+    }
+unlock:
+    pthread_mutex_unlock(&writer_mutex);
+    free(builder.data);
+    return return_value;
+}
+
+RegError registryLoad(char *path)
+{
+    logAssert(path != NULL)
+    struct stat file_status;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return CANNOT_ACCESS_FILE;
+    }
+    if (fstat(fd, &file_status) == -1)
+    {
+        close(fd);
+        return CANNOT_ACCESS_FILE;
+    }
+    if ((size_t)file_status.st_size < sizeof(struct ImageHeader))
+    {
+        close(fd);
+        return INVALID_IMAGE;
+    }
+    void *data = mmap(NULL, file_status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return CANNOT_ACCESS_FILE;
+    }
+    /* only the header is checked: the image is trusted to be written by
+    `registrySave`, and loading must not depend on the number of keys */
+    const struct ImageHeader *header = data;
+    size_t index_size = header->index_size;
+    if (memcmp(header->magic, REGISTRY_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != REGISTRY_IMAGE_VERSION || header->byte_order != 0x01020304 ||
+        header->key_header_size != sizeof(struct Key) || header->inline_value_size != INLINE_VALUE_SIZE ||
+        header->image_size != (uint64_t)file_status.st_size || index_size == 0 ||
+        (index_size & (index_size - 1)) != 0 || header->key_count >= index_size ||
+        header->index_offset + index_size * sizeof(struct ImageSlot) > header->image_size)
+    {
+        munmap(data, file_status.st_size);
+        return INVALID_IMAGE;
+    }
+    struct RegistryImage *image = malloc(sizeof(struct RegistryImage));
+    if (image == NULL)
+    {
+        munmap(data, file_status.st_size);
+        return CANNOT_ACCESS_FILE;
+    }
+    image->data = data;
+    image->size = file_status.st_size;
+    pthread_mutex_lock(&writer_mutex);
+    image->previous = atomic_load_explicit(&registry_image, memory_order_relaxed);
+    atomic_store(&registry_image, image);
+    pthread_mutex_unlock(&writer_mutex);
+    return OK;
+}
+
+////////// Read scaling benchmark //////////
+
+struct ReadBenchmark
+{
+    RegKey *keys;
+    int key_count;
+    atomic_bool stop;
+    atomic_uint_least64_t reads;
+};
+
+static void *readBenchmarkThread(void *argument)
+{
+    struct ReadBenchmark *benchmark = argument;
+    char value[STRING_SIZE];
+    uint64_t reads = 0;
+    unsigned seed = (unsigned)(uintptr_t)&value;
+    while (!atomic_load_explicit(&benchmark->stop, memory_order_relaxed))
+    {
+        seed = seed * 1103515245 + 12345;
+        RegKey key = findKey(benchmark->keys[seed % benchmark->key_count]->key_name);
+        if (key != NULL)
+        {
+            readValue(key, value);
+        }
+        reads++;
+    }
+    atomic_fetch_add(&benchmark->reads, reads);
+    return NULL;
+}
+
+/* Measures `findKey` + `readValue` throughput of `reader_count` threads over
+the published `keys` while the calling thread keeps updating values.
+Returns the number of reads per second. */
+double benchmarkRegistryReads(RegKey *keys, int key_count, int reader_count, int seconds)
+{
+    struct ReadBenchmark benchmark = {.keys = keys, .key_count = key_count};
+    pthread_t *readers = calloc(reader_count, sizeof(pthread_t));
+    int started = 0;
+    struct timespec start;
+    struct timespec now;
+    logAssert(readers != NULL)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (started < reader_count && pthread_create(&readers[started], NULL, readBenchmarkThread, &benchmark) == 0)
+    {
+        started++;
+    }
+    do
+    {
+        storeValue(keys[rand() % key_count], "UPDATED");
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec - start.tv_sec < seconds);
+    atomic_store(&benchmark.stop, true);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(readers[i], NULL);
+    }
+    free(readers);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+    return atomic_load(&benchmark.reads) / elapsed;
+}
+
+////////// Publish benchmark //////////
+
+struct PublishBenchmark
+{
+    int run;
+    int publisher;
+    int key_count;
+    int batch_size;
+    bool failed;
+};
+
+static void benchmarkKeyName(char *key_name, int run, int publisher, int key)
+{
+    snprintf(key_name, STRING_SIZE, "publish-benchmark-%d-%d-%d", run, publisher, key);
+}
+
+/* Publishes the keys of one publisher one by one or in batches */
+static void *publishBenchmarkThread(void *argument)
+{
+    struct PublishBenchmark *benchmark = argument;
+    char key_name[STRING_SIZE];
+    RegBatch batch = benchmark->batch_size > 1 ? createBatch() : NULL;
+    if (benchmark->batch_size > 1 && batch == NULL)
+    {
+        benchmark->failed = true;
+        return NULL;
+    }
+    for (int i = 0; i < benchmark->key_count && !benchmark->failed; i++)
+    {
+        benchmarkKeyName(key_name, benchmark->run, benchmark->publisher, i);
+        if (batch == NULL)
+        {
+            RegKey key = createKey(key_name);
+            if (key == NULL)
+            {
+                benchmark->failed = true;
+                break;
+            }
+            storeValue(key, "benchmark value");
+            if (publishKey(key) != OK)
+            {
+                destroyKey(key);
+                benchmark->failed = true;
+            }
+            continue;
+        }
+        bool batch_full = (i + 1) % benchmark->batch_size == 0 || i + 1 == benchmark->key_count;
+        if (batchAddKey(batch, key_name, "benchmark value") != OK || (batch_full && publishBatch(batch) != OK))
+        {
+            benchmark->failed = true;
+        }
+    }
+    if (batch != NULL)
+    {
+        destroyBatch(batch);
+    }
+    return NULL;
+}
+
+/* Measures how fast `publisher_count` threads, which contend for the
+writer lock, publish `key_count` new keys each: one by one with
+`publishKey` if `batch_size` is 1, otherwise in batches of `batch_size`
+keys with `publishBatch`. The keys are unpublished and destroyed again
+afterwards. Returns the wall time per published key in nanoseconds, or -1
+if not all keys could be published. */
+double benchmarkRegistryPublish(int publisher_count, int key_count, int batch_size)
+{
+    static atomic_int runs;
+    logAssert(publisher_count > 0 && key_count > 0 && batch_size > 0)
+    struct PublishBenchmark *benchmarks = calloc(publisher_count, sizeof(struct PublishBenchmark));
+    pthread_t *publishers = calloc(publisher_count, sizeof(pthread_t));
+    logAssert(benchmarks != NULL && publishers != NULL)
+    int run = atomic_fetch_add(&runs, 1);
+    int started = 0;
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (; started < publisher_count; started++)
+    {
+        benchmarks[started] = (struct PublishBenchmark){run, started, key_count, batch_size, false};
+        if (pthread_create(&publishers[started], NULL, publishBenchmarkThread, &benchmarks[started]) != 0)
+        {
+            break;
+        }
+    }
+    bool failed = (started < publisher_count);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(publishers[i], NULL);
+        failed = failed || benchmarks[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    char key_name[STRING_SIZE];
+    for (int publisher = 0; publisher < started; publisher++)
+    {
+        for (int i = 0; i < key_count; i++)
+        {
+            benchmarkKeyName(key_name, run, publisher, i);
+            RegKey key = findKey(key_name);
+            if (key != NULL && unpublishKey(key) == OK)
+            {
+                destroyKey(key);
+            }
+        }
+    }
+    free(publishers);
+    free(benchmarks);
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    return failed ? -1 : elapsed / ((double)publisher_count * key_count);
+}
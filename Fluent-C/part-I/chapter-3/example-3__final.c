@@ -1,116 +1,2251 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
-#define ELEMENT_SIZE 255
-#define MAX_ELEMENTS 10
+/* The pool serves sizes from 2^POOL_MIN_SHIFT (64 B) to 2^POOL_MAX_SHIFT (1 MB)
+in power-of-two size classes */
+#define POOL_MIN_SHIFT 6
+#define POOL_MAX_SHIFT 20
+#define POOL_CLASS_COUNT (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+/* each class grows by chunks of at least this size (and at least 4 elements) */
+#define POOL_CHUNK_SIZE (256 * 1024)
+#define POOL_MAX_CHUNKS 1024
+#define POOL_ELEMENT_MAGIC 0x504f4f4cu
+
+/* Every element starts with this header, so that `poolRelease` finds its
+class and slot by address arithmetic */
 typedef struct
 {
-    bool occupied;
-    char memory[ELEMENT_SIZE];
+    uint32_t magic;
+    uint32_t size_class;
+    uint32_t index;
+    /* size asked for by the caller while it is observed (see below), else 0 */
+    uint32_t requested;
+    /* index + 1 of the next free element while this one is in the free list */
+    atomic_uint next_free;
+    atomic_bool occupied;
+    _Alignas(16) char memory[];
 } PoolElement;
 
-static PoolElement memory_pool[MAX_ELEMENTS];
+/* Statistics of one size class */
+typedef struct
+{
+    size_t element_size;
+    uint64_t hits;        /* takes served from memory the class already had */
+    uint64_t misses;      /* takes that had to grow the class or failed */
+    uint64_t failures;    /* takes that returned `NULL` */
+    uint64_t in_use;      /* elements currently taken */
+    uint64_t observed;    /* elements currently taken that were taken while observing */
+    uint64_t requested;   /* bytes asked for by the observed elements in use */
+    uint64_t high_water;  /* maximum of `in_use` so far */
+    uint64_t chunks;      /* chunks allocated for the class */
+} PoolStatistics;
+
+typedef struct
+{
+    /* Lock-free stack of released elements. The lower 32 bits hold the index + 1
+    of the top element (0 if empty), the upper 32 bits a counter that changes
+    with every update, so that a concurrent pop/push sequence cannot make a
+    compare-and-swap succeed on a stale top element (ABA problem). */
+    atomic_uint_least64_t free_list;
+    /* elements from this index on have never been taken */
+    atomic_uint untouched;
+    _Atomic(char *) chunks[POOL_MAX_CHUNKS];
+    atomic_uint_least64_t hits;
+    atomic_uint_least64_t misses;
+    atomic_uint_least64_t failures;
+    atomic_uint_least64_t in_use;
+    atomic_uint_least64_t observed;
+    atomic_uint_least64_t requested;
+    atomic_uint_least64_t high_water;
+    atomic_uint_least64_t chunk_count;
+} PoolClass;
+
+static PoolClass memory_pool[POOL_CLASS_COUNT];
+/* growing is rare, so all classes share one lock for it */
+static pthread_mutex_t pool_grow_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* takes of more than 1 MB, which no class can serve */
+static atomic_uint_least64_t pool_oversize_failures;
+
+////////// Memory observability //////////
+
+/* The pool and `safeMalloc`/`safeFree` can record where memory is taken
+and how long taking and releasing it lasts. As long as observing is
+switched off, this costs one relaxed load per call. */
+
+#define MEMORY_LATENCY_BUCKETS 32
+#define MEMORY_CALL_SITES 128
+#define MEMORY_STRINGIFY_LINE(line) #line
+#define MEMORY_STRINGIFY(line) MEMORY_STRINGIFY_LINE(line)
+/* identifies the calling line; string literals have a stable address */
+#define MEMORY_CALL_SITE __FILE__ ":" MEMORY_STRINGIFY(__LINE__)
+
+/* Bucket i counts the calls that took less than 2^i nanoseconds (the last
+bucket counts all slower ones) */
+typedef struct
+{
+    atomic_uint_least64_t counts[MEMORY_LATENCY_BUCKETS];
+} LatencyHistogram;
+
+typedef struct
+{
+    _Atomic(const char *) site;
+    atomic_uint_least64_t allocations;
+    atomic_uint_least64_t bytes;
+} CallSiteCounter;
+
+/* Allocations of one call site since observing was switched on */
+typedef struct
+{
+    const char *site;
+    uint64_t allocations;
+    uint64_t bytes;
+} CallSiteStatistics;
+
+static atomic_bool memory_observing;
+static LatencyHistogram pool_take_latency;
+static LatencyHistogram pool_release_latency;
+static LatencyHistogram malloc_latency;
+static LatencyHistogram free_latency;
+static CallSiteCounter call_sites[MEMORY_CALL_SITES];
+/* calls from more sites than fit into the table */
+static atomic_uint_least64_t call_site_overflows;
+
+/* Switches recording of call sites, latencies and requested sizes on or off */
+void memorySetObserving(bool observing)
+{
+    atomic_store(&memory_observing, observing);
+}
+
+static inline bool memoryObserving()
+{
+    return __builtin_expect(atomic_load_explicit(&memory_observing, memory_order_relaxed), 0);
+}
+
+static uint64_t memoryNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void recordLatency(LatencyHistogram *histogram, uint64_t start)
+{
+    uint64_t nanoseconds = memoryNow() - start;
+    unsigned bucket = nanoseconds == 0 ? 0 : 64 - __builtin_clzll(nanoseconds);
+    if (bucket >= MEMORY_LATENCY_BUCKETS)
+    {
+        bucket = MEMORY_LATENCY_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&histogram->counts[bucket], 1, memory_order_relaxed);
+}
+
+static void recordCallSite(const char *site, size_t bytes)
+{
+    size_t start = ((uintptr_t)site >> 3) % MEMORY_CALL_SITES;
+    for (size_t i = 0; i < MEMORY_CALL_SITES; i++)
+    {
+        CallSiteCounter *counter = &call_sites[(start + i) % MEMORY_CALL_SITES];
+        const char *current = atomic_load(&counter->site);
+        if (current == NULL && atomic_compare_exchange_strong(&counter->site, &current, site))
+        {
+            current = site;
+        }
+        if (current == site)
+        {
+            atomic_fetch_add_explicit(&counter->allocations, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&counter->bytes, bytes, memory_order_relaxed);
+            return;
+        }
+    }
+    atomic_fetch_add(&call_site_overflows, 1);
+}
+
+static size_t poolElementSize(unsigned size_class)
+{
+    return (size_t)1 << (size_class + POOL_MIN_SHIFT);
+}
+
+static size_t poolStride(unsigned size_class)
+{
+    return sizeof(PoolElement) + poolElementSize(size_class);
+}
+
+static size_t poolElementsPerChunk(unsigned size_class)
+{
+    size_t elements = POOL_CHUNK_SIZE / poolStride(size_class);
+    return elements < 4 ? 4 : elements;
+}
+
+static PoolElement *poolElement(PoolClass *pool_class, unsigned size_class, uint32_t index)
+{
+    size_t per_chunk = poolElementsPerChunk(size_class);
+    char *chunk = atomic_load_explicit(&pool_class->chunks[index / per_chunk], memory_order_acquire);
+    return (PoolElement *)(chunk + (index % per_chunk) * poolStride(size_class));
+}
+
+/* Makes sure the chunk holding element `index` exists. Returns `false` in
+case of insufficient memory. */
+static bool poolGrow(PoolClass *pool_class, unsigned size_class, uint32_t index)
+{
+    size_t per_chunk = poolElementsPerChunk(size_class);
+    size_t chunk_index = index / per_chunk;
+    bool grown = true;
+    if (atomic_load_explicit(&pool_class->chunks[chunk_index], memory_order_acquire) != NULL)
+    {
+        return true;
+    }
+    pthread_mutex_lock(&pool_grow_mutex);
+    if (atomic_load_explicit(&pool_class->chunks[chunk_index], memory_order_relaxed) == NULL)
+    {
+        char *chunk = aligned_alloc(16, per_chunk * poolStride(size_class));
+        if (chunk == NULL)
+        {
+            grown = false;
+        }
+        else
+        {
+            for (size_t i = 0; i < per_chunk; i++)
+            {
+                PoolElement *element = (PoolElement *)(chunk + i * poolStride(size_class));
+                element->magic = POOL_ELEMENT_MAGIC;
+                element->size_class = size_class;
+                element->index = chunk_index * per_chunk + i;
+                element->requested = 0;
+                atomic_init(&element->next_free, 0);
+                atomic_init(&element->occupied, false);
+            }
+            atomic_store_explicit(&pool_class->chunks[chunk_index], chunk, memory_order_release);
+            atomic_fetch_add(&pool_class->chunk_count, 1);
+        }
+    }
+    pthread_mutex_unlock(&pool_grow_mutex);
+    return grown;
+}
+
+static void *poolTakeElement(PoolClass *pool_class, PoolElement *element)
+{
+    atomic_store(&element->occupied, true);
+    uint64_t in_use = atomic_fetch_add(&pool_class->in_use, 1) + 1;
+    uint64_t high_water = atomic_load(&pool_class->high_water);
+    while (in_use > high_water && !atomic_compare_exchange_weak(&pool_class->high_water, &high_water, in_use))
+    {
+    }
+    return element->memory;
+}
 
-void *poolTake(size_t size)
+static void *poolTakeUnobserved(size_t size)
 {
-    if (size <= ELEMENT_SIZE)
+    unsigned size_class = 0;
+    while (size_class < POOL_CLASS_COUNT && poolElementSize(size_class) < size)
+    {
+        size_class++;
+    }
+    if (size_class == POOL_CLASS_COUNT)
+    {
+        atomic_fetch_add(&pool_oversize_failures, 1);
+        return NULL;
+    }
+    PoolClass *pool_class = &memory_pool[size_class];
+    uint64_t head = atomic_load(&pool_class->free_list);
+    while ((uint32_t)head != 0)
+    {
+        PoolElement *element = poolElement(pool_class, size_class, (uint32_t)head - 1);
+        uint64_t next = ((head >> 32) + 1) << 32 | atomic_load(&element->next_free);
+        if (atomic_compare_exchange_weak(&pool_class->free_list, &head, next))
+        {
+            atomic_fetch_add(&pool_class->hits, 1);
+            return poolTakeElement(pool_class, element);
+        }
+    }
+    unsigned untouched = atomic_load(&pool_class->untouched);
+    size_t capacity = POOL_MAX_CHUNKS * poolElementsPerChunk(size_class);
+    while (untouched < capacity)
     {
-        for (int i = 0; i < MAX_ELEMENTS; i++)
+        if (atomic_compare_exchange_weak(&pool_class->untouched, &untouched, untouched + 1))
         {
-            if (memory_pool[i].occupied == false)
+            bool chunk_exists = atomic_load(&pool_class->chunks[untouched / poolElementsPerChunk(size_class)]) != NULL;
+            if (!poolGrow(pool_class, size_class, untouched))
             {
-                memory_pool[i].occupied = true;
-                return &(memory_pool[i].memory);
+                break;
             }
+            atomic_fetch_add(chunk_exists ? &pool_class->hits : &pool_class->misses, 1);
+            return poolTakeElement(pool_class, poolElement(pool_class, size_class, untouched));
         }
     }
+    atomic_fetch_add(&pool_class->misses, 1);
+    atomic_fetch_add(&pool_class->failures, 1);
     return NULL;
 }
 
+/* Returns memory for at least `size` bytes (max. 1 MB) from the size class
+that fits, or `NULL` if there is no memory left. Use it through the
+`poolTake` macro, which passes the calling line as `call_site`. */
+void *poolTakeAt(size_t size, const char *call_site)
+{
+    if (!memoryObserving())
+    {
+        return poolTakeUnobserved(size);
+    }
+    uint64_t start = memoryNow();
+    void *pointer = poolTakeUnobserved(size);
+    recordLatency(&pool_take_latency, start);
+    if (pointer != NULL)
+    {
+        PoolElement *element = (PoolElement *)((char *)pointer - offsetof(PoolElement, memory));
+        /* a size of 0 leaves the element unobserved */
+        element->requested = size;
+        if (size != 0)
+        {
+            atomic_fetch_add(&memory_pool[element->size_class].observed, 1);
+            atomic_fetch_add(&memory_pool[element->size_class].requested, size);
+        }
+        recordCallSite(call_site, size);
+    }
+    return pointer;
+}
+
+#define poolTake(size) poolTakeAt((size), MEMORY_CALL_SITE)
+
+static void poolReleaseUnobserved(void *pointer)
+{
+    PoolElement *element = (PoolElement *)((char *)pointer - offsetof(PoolElement, memory));
+    assert(element->magic == POOL_ELEMENT_MAGIC && "Not a pool element");
+    PoolClass *pool_class = &memory_pool[element->size_class];
+    if (!atomic_exchange(&element->occupied, false))
+    {
+        /* released twice */
+        return;
+    }
+    atomic_fetch_sub(&pool_class->in_use, 1);
+    if (element->requested != 0)
+    {
+        atomic_fetch_sub(&pool_class->observed, 1);
+        atomic_fetch_sub(&pool_class->requested, element->requested);
+        element->requested = 0;
+    }
+    uint64_t head = atomic_load(&pool_class->free_list);
+    do
+    {
+        atomic_store(&element->next_free, (uint32_t)head);
+    } while (!atomic_compare_exchange_weak(&pool_class->free_list, &head,
+                                           ((head >> 32) + 1) << 32 | (element->index + 1)));
+}
+
+/* Returns memory taken with `poolTake` to its size class. `NULL` is ignored. */
 void poolRelease(void *pointer)
 {
-    for (int i = 0; i < MAX_ELEMENTS; i++)
+    if (pointer == NULL)
+    {
+        return;
+    }
+    if (!memoryObserving())
+    {
+        poolReleaseUnobserved(pointer);
+        return;
+    }
+    uint64_t start = memoryNow();
+    poolReleaseUnobserved(pointer);
+    recordLatency(&pool_release_latency, start);
+}
+
+/* Stores the statistics of all size classes into `statistics`, which has
+to be provided by the caller with `POOL_CLASS_COUNT` elements */
+void poolGetStatistics(PoolStatistics *statistics)
+{
+    for (unsigned i = 0; i < POOL_CLASS_COUNT; i++)
+    {
+        statistics[i].element_size = poolElementSize(i);
+        statistics[i].hits = atomic_load(&memory_pool[i].hits);
+        statistics[i].misses = atomic_load(&memory_pool[i].misses);
+        statistics[i].failures = atomic_load(&memory_pool[i].failures);
+        statistics[i].in_use = atomic_load(&memory_pool[i].in_use);
+        statistics[i].observed = atomic_load(&memory_pool[i].observed);
+        statistics[i].requested = atomic_load(&memory_pool[i].requested);
+        statistics[i].high_water = atomic_load(&memory_pool[i].high_water);
+        statistics[i].chunks = atomic_load(&memory_pool[i].chunk_count);
+    }
+}
+
+/* `safeMalloc` puts this header in front of the memory, so that
+`safeFree` knows how much is released */
+typedef struct
+{
+    size_t size;
+    size_t padding;
+} MallocHeader;
+
+static atomic_uint_least64_t malloc_count;
+static atomic_uint_least64_t malloc_failures;
+static atomic_uint_least64_t malloc_in_use;
+static atomic_uint_least64_t malloc_high_water;
+
+/* Allocates memory and asserts if no memory is available. Use it through
+the `safeMalloc` macro, which passes the calling line as `call_site`. */
+void *safeMallocAt(size_t size, const char *call_site)
+{
+    bool observing = memoryObserving();
+    uint64_t start = observing ? memoryNow() : 0;
+    MallocHeader *header = malloc(sizeof(MallocHeader) + size);
+    if (header == NULL)
+    {
+        atomic_fetch_add(&malloc_failures, 1);
+    }
+    assert(header);
+    if (header == NULL)
+    {
+        return NULL;
+    }
+    header->size = size;
+    atomic_fetch_add_explicit(&malloc_count, 1, memory_order_relaxed);
+    uint64_t in_use = atomic_fetch_add_explicit(&malloc_in_use, size, memory_order_relaxed) + size;
+    uint64_t high_water = atomic_load_explicit(&malloc_high_water, memory_order_relaxed);
+    while (in_use > high_water && !atomic_compare_exchange_weak(&malloc_high_water, &high_water, in_use))
+    {
+    }
+    if (observing)
+    {
+        recordLatency(&malloc_latency, start);
+        recordCallSite(call_site, size);
+    }
+    return header + 1;
+}
+
+#define safeMalloc(size) safeMallocAt((size), MEMORY_CALL_SITE)
+
+/* Deallocates the memory of the provided 'pointer' */
+void safeFree(void *pointer)
+{
+    if (pointer == NULL)
     {
-        if (&(memory_pool[i].memory) == pointer)
+        return;
+    }
+    bool observing = memoryObserving();
+    uint64_t start = observing ? memoryNow() : 0;
+    MallocHeader *header = (MallocHeader *)pointer - 1;
+    atomic_fetch_sub_explicit(&malloc_in_use, header->size, memory_order_relaxed);
+    free(header);
+    if (observing)
+    {
+        recordLatency(&free_latency, start);
+    }
+}
+
+/* Everything the pool and `safeMalloc` recorded */
+typedef struct
+{
+    PoolStatistics pool[POOL_CLASS_COUNT];
+    uint64_t pool_oversize_failures;
+    uint64_t malloc_count;
+    uint64_t malloc_failures;
+    uint64_t malloc_in_use;       /* bytes */
+    uint64_t malloc_high_water;   /* bytes */
+    uint64_t pool_take_latency[MEMORY_LATENCY_BUCKETS];
+    uint64_t pool_release_latency[MEMORY_LATENCY_BUCKETS];
+    uint64_t malloc_latency[MEMORY_LATENCY_BUCKETS];
+    uint64_t free_latency[MEMORY_LATENCY_BUCKETS];
+    size_t call_site_count;
+    CallSiteStatistics call_sites[MEMORY_CALL_SITES];
+    uint64_t call_site_overflows;
+} MemoryStatistics;
+
+static void copyHistogram(uint64_t *counts, LatencyHistogram *histogram)
+{
+    for (int i = 0; i < MEMORY_LATENCY_BUCKETS; i++)
+    {
+        counts[i] = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+}
+
+/* Stores a snapshot of all memory statistics into `statistics`. The
+counters are read one by one while other threads may go on allocating. */
+void memoryGetStatistics(MemoryStatistics *statistics)
+{
+    memset(statistics, 0, sizeof(*statistics));
+    poolGetStatistics(statistics->pool);
+    statistics->pool_oversize_failures = atomic_load(&pool_oversize_failures);
+    statistics->malloc_count = atomic_load(&malloc_count);
+    statistics->malloc_failures = atomic_load(&malloc_failures);
+    statistics->malloc_in_use = atomic_load(&malloc_in_use);
+    statistics->malloc_high_water = atomic_load(&malloc_high_water);
+    copyHistogram(statistics->pool_take_latency, &pool_take_latency);
+    copyHistogram(statistics->pool_release_latency, &pool_release_latency);
+    copyHistogram(statistics->malloc_latency, &malloc_latency);
+    copyHistogram(statistics->free_latency, &free_latency);
+    for (int i = 0; i < MEMORY_CALL_SITES; i++)
+    {
+        const char *site = atomic_load(&call_sites[i].site);
+        if (site != NULL)
         {
-            memory_pool[i].occupied = false;
-            return;
+            CallSiteStatistics *call_site = &statistics->call_sites[statistics->call_site_count++];
+            call_site->site = site;
+            call_site->allocations = atomic_load(&call_sites[i].allocations);
+            call_site->bytes = atomic_load(&call_sites[i].bytes);
         }
     }
+    statistics->call_site_overflows = atomic_load(&call_site_overflows);
 }
 
-#define MAX_FILENAME_SIZE ELEMENT_SIZE
+static void writeHistogramJson(FILE *stream, const char *name, const uint64_t *counts)
+{
+    fprintf(stream, "  \"%s\": [", name);
+    for (int i = 0; i < MEMORY_LATENCY_BUCKETS; i++)
+    {
+        fprintf(stream, "%s%llu", i ? ", " : "", (unsigned long long)counts[i]);
+    }
+    fprintf(stream, "],\n");
+}
 
-/* Performs a Caesar encryption with the fixed key 3.
-The parameter `text` must contain a text with only capital letters.
-The parameter `length` must contain the length of the text excluding `NULL` termination. */
-void caesar(char *text, int length)
+/* Writes the memory statistics as a JSON object to `stream`. The
+`fragmentation` of a size class is the share of the bytes of its observed
+in-use elements that the callers did not ask for; elements taken before
+observing was switched on are left out. */
+void memoryWriteStatisticsJson(FILE *stream)
+{
+    MemoryStatistics *statistics = malloc(sizeof(MemoryStatistics));
+    if (statistics == NULL)
+    {
+        return;
+    }
+    memoryGetStatistics(statistics);
+    fprintf(stream, "{\n  \"observing\": %s,\n  \"pool\": [\n", memoryObserving() ? "true" : "false");
+    for (int i = 0; i < POOL_CLASS_COUNT; i++)
+    {
+        PoolStatistics *pool = &statistics->pool[i];
+        double fragmentation =
+            pool->observed == 0 ? 0 : 1 - (double)pool->requested / (pool->observed * pool->element_size);
+        fprintf(stream,
+                "    {\"element_size\": %zu, \"hits\": %llu, \"misses\": %llu, \"failures\": %llu, "
+                "\"in_use\": %llu, \"observed\": %llu, \"high_water\": %llu, \"chunks\": %llu, "
+                "\"fragmentation\": %.3f}%s\n",
+                pool->element_size, (unsigned long long)pool->hits, (unsigned long long)pool->misses,
+                (unsigned long long)pool->failures, (unsigned long long)pool->in_use,
+                (unsigned long long)pool->observed, (unsigned long long)pool->high_water,
+                (unsigned long long)pool->chunks, fragmentation,
+                i + 1 < POOL_CLASS_COUNT ? "," : "");
+    }
+    fprintf(stream, "  ],\n  \"pool_oversize_failures\": %llu,\n",
+            (unsigned long long)statistics->pool_oversize_failures);
+    fprintf(stream,
+            "  \"malloc\": {\"count\": %llu, \"failures\": %llu, \"in_use\": %llu, \"high_water\": %llu},\n",
+            (unsigned long long)statistics->malloc_count, (unsigned long long)statistics->malloc_failures,
+            (unsigned long long)statistics->malloc_in_use, (unsigned long long)statistics->malloc_high_water);
+    writeHistogramJson(stream, "pool_take_latency_log2_ns", statistics->pool_take_latency);
+    writeHistogramJson(stream, "pool_release_latency_log2_ns", statistics->pool_release_latency);
+    writeHistogramJson(stream, "malloc_latency_log2_ns", statistics->malloc_latency);
+    writeHistogramJson(stream, "free_latency_log2_ns", statistics->free_latency);
+    fprintf(stream, "  \"call_sites\": [\n");
+    for (size_t i = 0; i < statistics->call_site_count; i++)
+    {
+        CallSiteStatistics *call_site = &statistics->call_sites[i];
+        fprintf(stream, "    {\"site\": \"%s\", \"allocations\": %llu, \"bytes\": %llu}%s\n", call_site->site,
+                (unsigned long long)call_site->allocations, (unsigned long long)call_site->bytes,
+                i + 1 < statistics->call_site_count ? "," : "");
+    }
+    fprintf(stream, "  ],\n  \"call_site_overflows\": %llu\n}\n",
+            (unsigned long long)statistics->call_site_overflows);
+    free(statistics);
+}
+
+////////// Arena //////////
+
+/* A bump-pointer arena for batch jobs: allocations only move a pointer,
+and all of them are released at once with `arenaReset` (keeping the
+memory for the next batch) or `arenaDestroy`. An arena is not thread-safe;
+each thread or batch uses its own. */
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size;                        /* usable bytes in `memory` */
+    size_t mapped_size;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) char memory[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *first;
+    ArenaBlock *current;
+    size_t block_size;
+    bool huge_pages;
+} Arena;
+
+static ArenaBlock *arenaMapBlock(size_t size, bool huge_pages)
 {
-    for (int i = 0; i < length; i++)
+    size_t page_size = huge_pages ? ARENA_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (sizeof(ArenaBlock) + size + page_size - 1) / page_size * page_size;
+    void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge_pages)
+    {
+        /* explicit huge pages need a reserved pool (vm.nr_hugepages) */
+        memory = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (memory == MAP_FAILED)
     {
-        /* Characters in C are stored as numeric values, and you can shift the character
-        down the alphabet by adding a numeric value to a character.
-        */
-        text[i] = text[i] + 3;
-        if (text[i] > 'Z')
+        memory = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
         {
-            // If we shift beyond the letter Z, we restart at the beginning of the alphabet.
-            text[i] = text[i] - 'Z' + 'A' - 1;
+            /* otherwise ask for transparent huge pages */
+            madvise(memory, mapped_size, MADV_HUGEPAGE);
         }
+#endif
     }
+    ArenaBlock *block = memory;
+    block->next = NULL;
+    block->size = mapped_size - sizeof(ArenaBlock);
+    block->mapped_size = mapped_size;
+    block->used = 0;
+    return block;
 }
 
-/* Returns the length of the file with the provided `filename` */
-int getFileLength(char *filename)
+/* Creates an arena that grows by blocks of at least `block_size` bytes,
+backed by huge pages if `huge_pages` is set and the system provides them.
+Returns `NULL` in case of insufficient memory. */
+Arena *arenaCreate(size_t block_size, bool huge_pages)
 {
-    FILE *f = fopen(filename, "r");
-    fseek(f, 0, SEEK_END);
-    int file_length = ftell(f);
-    fclose(f);
-    return file_length;
+    Arena *arena = malloc(sizeof(Arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    arena->block_size = block_size;
+    arena->huge_pages = huge_pages;
+    arena->first = arenaMapBlock(block_size, huge_pages);
+    arena->current = arena->first;
+    if (arena->first == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+    return arena;
 }
 
-/* Stores the content of the file with the provided `filename` into the
-provided `buffer` (which has to be least of size `file_length`). The
-file must only contain capital letters with no newline in between
-(that's what our caesar function accepts as input). */
-void readFileContent(char *filename, char *buffer, int file_length)
+/* Returns `size` bytes (aligned to 16 bytes) from the `arena`, or `NULL`
+in case of insufficient memory */
+void *arenaAlloc(Arena *arena, size_t size)
 {
-    FILE *f = fopen(filename, "r");
-    fseek(f, 0, SEEK_SET);
-    int read_elements = fread(buffer, 1, file_length, f);
-    buffer[read_elements] = '\0';
-    fclose(f);
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->current;
+    if (block->size - block->used < size)
+    {
+        /* after a reset, the following blocks are empty again */
+        if (block->next != NULL && block->next->size >= size)
+        {
+            block = block->next;
+        }
+        else
+        {
+            ArenaBlock *new_block = arenaMapBlock(size > arena->block_size ? size : arena->block_size,
+                                                  arena->huge_pages);
+            if (new_block == NULL)
+            {
+                return NULL;
+            }
+            new_block->next = block->next;
+            block->next = new_block;
+            block = new_block;
+        }
+        arena->current = block;
+    }
+    void *pointer = block->memory + block->used;
+    block->used += size;
+    return pointer;
 }
 
-/* Prints the Caesar-encrypted 'filename'.This function is responsible for
-allocating and deallocating the required buffers for storing the
-file content.
-Notes: The filename must be all capital letters and we accept that the
-'.' of the filename will also be shifted by the Caesar encryption. */
-void encryptCaesarFilename(char *filename)
+/* Releases everything allocated from the `arena` at once. The blocks are
+kept for the following allocations. */
+void arenaReset(Arena *arena)
 {
-    char *buffer = poolTake(MAX_FILENAME_SIZE);
-    if (buffer != NULL)
+    for (ArenaBlock *block = arena->first; block != NULL; block = block->next)
     {
-        strlcpy(buffer, filename, MAX_FILENAME_SIZE);
-        caesar(buffer, strnlen(buffer, MAX_FILENAME_SIZE));
-        printf("\nEncrypted filename: %s ", buffer);
-        poolRelease(buffer);
+        block->used = 0;
     }
+    arena->current = arena->first;
 }
 
-/* For all files in the current directory, this function reads text from the
-file and prints the Caesar-encrypted text. */
-void encryptDirectoryContent()
+/* Releases the `arena` and all its memory */
+void arenaDestroy(Arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+    ArenaBlock *block = arena->first;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        munmap(block, block->mapped_size);
+        block = next;
+    }
+    free(arena);
+}
+
+#define MAX_FILENAME_SIZE 255
+
+/* How `caesarEncrypt` treats the text */
+typedef enum
+{
+    /* shift every byte and wrap around after 'Z' (only meaningful for
+    capital letters, like the original `caesar`) */
+    CAESAR_SHIFT_ALL,
+    /* rotate capital and small letters within their case and pass all
+    other bytes through unchanged */
+    CAESAR_LETTERS_ONLY
+} CaesarMode;
+
+/* Encrypts `length` bytes of `text` starting at `offset` with the scalar
+reference implementation */
+static void caesarScalar(char *text, size_t offset, size_t length, int key, CaesarMode mode)
+{
+    for (size_t i = offset; i < length; i++)
+    {
+        if (mode == CAESAR_SHIFT_ALL)
+        {
+            /* Characters in C are stored as numeric values, and you can shift the character
+            down the alphabet by adding a numeric value to a character.
+            */
+            text[i] = (signed char)(text[i] + key);
+            if ((signed char)text[i] > 'Z')
+            {
+                // If we shift beyond the letter Z, we restart at the beginning of the alphabet.
+                text[i] = text[i] - 'Z' + 'A' - 1;
+            }
+        }
+        else if (text[i] >= 'A' && text[i] <= 'Z')
+        {
+            text[i] = 'A' + (text[i] - 'A' + key) % 26;
+        }
+        else if (text[i] >= 'a' && text[i] <= 'z')
+        {
+            text[i] = 'a' + (text[i] - 'a' + key) % 26;
+        }
+    }
+}
+
+typedef void (*CaesarFunction)(char *text, size_t length, int key, CaesarMode mode);
+
+static void caesarScalarKernel(char *text, size_t length, int key, CaesarMode mode)
+{
+    caesarScalar(text, 0, length, key, mode);
+}
+
+#ifdef HAVE_X86_SIMD
+/* All vector kernels do the same per byte: add the key, compare, and
+conditionally subtract 26 - just like the scalar version, but on 16, 32 or
+64 bytes per instruction. Letters are handled relative to 'A'/'a', where the
+letter range is 0..25 for exactly the bytes that are letters. */
+static __m128i caesarLettersSse2(__m128i data, __m128i first, __m128i key, __m128i alphabet_end)
+{
+    __m128i position = _mm_sub_epi8(data, first);
+    __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(position, _mm_set1_epi8(-1)),
+                                      _mm_cmplt_epi8(position, _mm_set1_epi8(26)));
+    __m128i shifted = _mm_add_epi8(position, key);
+    shifted = _mm_sub_epi8(shifted, _mm_and_si128(_mm_cmpgt_epi8(shifted, alphabet_end), _mm_set1_epi8(26)));
+    shifted = _mm_add_epi8(shifted, first);
+    return _mm_or_si128(_mm_and_si128(is_letter, shifted), _mm_andnot_si128(is_letter, data));
+}
+
+static void caesarSse2(char *text, size_t length, int key, CaesarMode mode)
+{
+    __m128i key_vector = _mm_set1_epi8((char)key);
+    __m128i z_vector = _mm_set1_epi8('Z');
+    __m128i alphabet_end = _mm_set1_epi8(25);
+    __m128i wrap = _mm_set1_epi8(26);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i data = _mm_loadu_si128((__m128i *)(text + i));
+        if (mode == CAESAR_SHIFT_ALL)
+        {
+            data = _mm_add_epi8(data, key_vector);
+            data = _mm_sub_epi8(data, _mm_and_si128(_mm_cmpgt_epi8(data, z_vector), wrap));
+        }
+        else
+        {
+            data = caesarLettersSse2(data, _mm_set1_epi8('A'), key_vector, alphabet_end);
+            data = caesarLettersSse2(data, _mm_set1_epi8('a'), key_vector, alphabet_end);
+        }
+        _mm_storeu_si128((__m128i *)(text + i), data);
+    }
+    caesarScalar(text, i, length, key, mode);
+}
+
+__attribute__((target("avx2"))) static __m256i caesarLettersAvx2(__m256i data, __m256i first, __m256i key,
+                                                                  __m256i alphabet_end)
+{
+    __m256i position = _mm256_sub_epi8(data, first);
+    __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(position, _mm256_set1_epi8(-1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8(26), position));
+    __m256i shifted = _mm256_add_epi8(position, key);
+    shifted = _mm256_sub_epi8(shifted, _mm256_and_si256(_mm256_cmpgt_epi8(shifted, alphabet_end),
+                                                        _mm256_set1_epi8(26)));
+    shifted = _mm256_add_epi8(shifted, first);
+    return _mm256_blendv_epi8(data, shifted, is_letter);
+}
+
+__attribute__((target("avx2"))) static void caesarAvx2(char *text, size_t length, int key, CaesarMode mode)
 {
-    struct dirent *directory_entry;
-    DIR *directory = opendir(".");
-    while ((directory_entry = readdir(directory)) != NULL)
+    __m256i key_vector = _mm256_set1_epi8((char)key);
+    __m256i z_vector = _mm256_set1_epi8('Z');
+    __m256i alphabet_end = _mm256_set1_epi8(25);
+    __m256i wrap = _mm256_set1_epi8(26);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
     {
-        encryptCaesarFilename(directory_entry->d_name);
-        encryptCaesarFile(directory_entry->d_name);
+        __m256i data = _mm256_loadu_si256((__m256i *)(text + i));
+        if (mode == CAESAR_SHIFT_ALL)
+        {
+            data = _mm256_add_epi8(data, key_vector);
+            data = _mm256_sub_epi8(data, _mm256_and_si256(_mm256_cmpgt_epi8(data, z_vector), wrap));
+        }
+        else
+        {
+            data = caesarLettersAvx2(data, _mm256_set1_epi8('A'), key_vector, alphabet_end);
+            data = caesarLettersAvx2(data, _mm256_set1_epi8('a'), key_vector, alphabet_end);
+        }
+        _mm256_storeu_si256((__m256i *)(text + i), data);
+    }
+    caesarScalar(text, i, length, key, mode);
+}
+
+__attribute__((target("avx512bw"))) static __m512i caesarLettersAvx512(__m512i data, __m512i first, __m512i key,
+                                                                       __m512i alphabet_end)
+{
+    __m512i position = _mm512_sub_epi8(data, first);
+    __mmask64 is_letter = _mm512_cmplt_epu8_mask(position, _mm512_set1_epi8(26));
+    __m512i shifted = _mm512_add_epi8(position, key);
+    shifted = _mm512_mask_sub_epi8(shifted, _mm512_cmpgt_epi8_mask(shifted, alphabet_end), shifted,
+                                   _mm512_set1_epi8(26));
+    return _mm512_mask_add_epi8(data, is_letter, shifted, first);
+}
+
+__attribute__((target("avx512bw"))) static void caesarAvx512(char *text, size_t length, int key, CaesarMode mode)
+{
+    __m512i key_vector = _mm512_set1_epi8((char)key);
+    __m512i z_vector = _mm512_set1_epi8('Z');
+    __m512i alphabet_end = _mm512_set1_epi8(25);
+    __m512i wrap = _mm512_set1_epi8(26);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m512i data = _mm512_loadu_si512((__m512i *)(text + i));
+        if (mode == CAESAR_SHIFT_ALL)
+        {
+            data = _mm512_add_epi8(data, key_vector);
+            data = _mm512_mask_sub_epi8(data, _mm512_cmpgt_epi8_mask(data, z_vector), data, wrap);
+        }
+        else
+        {
+            data = caesarLettersAvx512(data, _mm512_set1_epi8('A'), key_vector, alphabet_end);
+            data = caesarLettersAvx512(data, _mm512_set1_epi8('a'), key_vector, alphabet_end);
+        }
+        _mm512_storeu_si512((__m512i *)(text + i), data);
     }
-    closedir(directory);
-}
\ No newline at end of file
+    caesarScalar(text, i, length, key, mode);
+}
+#endif
+
+static CaesarFunction caesar_function;
+static pthread_once_t caesar_once = PTHREAD_ONCE_INIT;
+
+/* Picks the widest kernel the CPU supports */
+static void initCaesarFunction()
+{
+    caesar_function = caesarScalarKernel;
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        caesar_function = caesarAvx512;
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        caesar_function = caesarAvx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        caesar_function = caesarSse2;
+    }
+#endif
+}
+
+/* Performs a Caesar encryption of the `length` bytes of `text` with the
+provided `key` (0 to 25) */
+void caesarEncrypt(char *text, size_t length, int key, CaesarMode mode)
+{
+    assert(key >= 0 && key < 26 && "Invalid key");
+    pthread_once(&caesar_once, initCaesarFunction);
+    caesar_function(text, length, key, mode);
+}
+
+/* Reverts `caesarEncrypt` with the same `key` and `mode` (for
+`CAESAR_SHIFT_ALL`, only capital letters can be restored) */
+void caesarDecrypt(char *text, size_t length, int key, CaesarMode mode)
+{
+    assert(key >= 0 && key < 26 && "Invalid key");
+    caesarEncrypt(text, length, (26 - key) % 26, mode);
+}
+
+/* Performs a Caesar encryption with the fixed key 3.
+The parameter `text` must contain a text with only capital letters.
+The parameter `length` must contain the length of the text excluding `NULL` termination. */
+void caesar(char *text, int length)
+{
+    caesarEncrypt(text, length, 3, CAESAR_SHIFT_ALL);
+}
+
+/* Checks the selected kernel against the scalar version for all keys and
+modes on random bytes, then measures its throughput on a `length`-byte
+buffer. Returns the throughput in GB/s or a negative value on mismatch. */
+double benchmarkCaesar(size_t length, int rounds)
+{
+    char *text = malloc(length);
+    char *reference = malloc(length);
+    double throughput = -1;
+    if (text == NULL || reference == NULL)
+    {
+        goto cleanup;
+    }
+    pthread_once(&caesar_once, initCaesarFunction);
+    for (size_t i = 0; i < length; i++)
+    {
+        text[i] = (char)rand();
+    }
+    for (int key = 0; key < 26; key++)
+    {
+        for (int mode = CAESAR_SHIFT_ALL; mode <= CAESAR_LETTERS_ONLY; mode++)
+        {
+            /* odd lengths also exercise the scalar tail of the kernels */
+            size_t check_length = length < 4099 ? length : 4099;
+            memcpy(reference, text, check_length);
+            caesarScalar(reference, 0, check_length, key, mode);
+            caesarEncrypt(text, check_length, key, mode);
+            if (memcmp(text, reference, check_length) != 0)
+            {
+                goto cleanup;
+            }
+        }
+    }
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; i++)
+    {
+        caesarEncrypt(text, length, 3, CAESAR_LETTERS_ONLY);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    throughput = (double)length * rounds / seconds / 1e9;
+cleanup:
+    free(text);
+    free(reference);
+    return throughput;
+}
+
+/* Files are mapped in windows of this size, so that files bigger than
+the address space (or RAM) are processed piece by piece */
+#define CAESAR_WINDOW_SIZE ((off_t)64 * 1024 * 1024)
+
+/* Writes all `length` bytes of `data` to the file descriptor `fd` */
+static bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+/* Encrypts the file with the provided `source` name window by window.
+Each window is mapped copy-on-write and encrypted directly in the mapping,
+then written to a temporary file next to `destination`, which is renamed
+over `destination` at the end. The source therefore stays intact even if
+`destination` names the same file. If `destination` is NULL, the file is
+mapped shared and encrypted in place instead. No heap buffer is involved
+in either case. Returns true on success. */
+bool encryptCaesarFileTo(const char *source, const char *destination, int key, CaesarMode mode)
+{
+    bool in_place = (destination == NULL);
+    int source_fd = open(source, in_place ? O_RDWR : O_RDONLY);
+    if (source_fd == -1)
+    {
+        return false;
+    }
+    struct stat file_status;
+    int destination_fd = -1;
+    char temporary_path[PATH_MAX];
+    bool success = false;
+    if (fstat(source_fd, &file_status) == -1 || !S_ISREG(file_status.st_mode))
+    {
+        goto cleanup;
+    }
+    if (!in_place)
+    {
+        if (snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", destination) >=
+            (int)sizeof(temporary_path))
+        {
+            goto cleanup;
+        }
+        destination_fd = mkstemp(temporary_path);
+        if (destination_fd == -1)
+        {
+            goto cleanup;
+        }
+        fchmod(destination_fd, 0644);
+    }
+    for (off_t offset = 0; offset < file_status.st_size; offset += CAESAR_WINDOW_SIZE)
+    {
+        size_t window = file_status.st_size - offset < CAESAR_WINDOW_SIZE ? file_status.st_size - offset
+                                                                           : CAESAR_WINDOW_SIZE;
+        char *data = mmap(NULL, window, PROT_READ | PROT_WRITE, in_place ? MAP_SHARED : MAP_PRIVATE, source_fd,
+                          offset);
+        if (data == MAP_FAILED)
+        {
+            goto cleanup;
+        }
+        madvise(data, window, MADV_SEQUENTIAL);
+        caesarEncrypt(data, window, key, mode);
+        bool written = in_place || writeAll(destination_fd, data, window);
+        munmap(data, window);
+        if (!written)
+        {
+            goto cleanup;
+        }
+    }
+    success = true;
+cleanup:
+    if (destination_fd != -1)
+    {
+        if (close(destination_fd) == -1 || (success && rename(temporary_path, destination) == -1))
+        {
+            success = false;
+        }
+        if (!success)
+        {
+            unlink(temporary_path);
+        }
+    }
+    close(source_fd);
+    return success;
+}
+
+/* Writes the Caesar-encrypted text of the file 'filename' to `stream`.
+The file is mapped and encrypted in the (private) mapping, so it is
+opened only once and never copied into a heap buffer. Like before, the
+text ends at the first `NULL` byte. Returns the number of bytes
+encrypted. */
+static size_t encryptCaesarFileToStream(const char *filename, FILE *stream)
+{
+    size_t length = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    struct stat file_status;
+    if (fstat(fd, &file_status) == 0 && S_ISREG(file_status.st_mode) && file_status.st_size > 0)
+    {
+        char *text = mmap(NULL, file_status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED)
+        {
+            length = strnlen(text, file_status.st_size);
+            caesar(text, length);
+            fprintf(stream, "Encrypted text: ");
+            fwrite(text, 1, length, stream);
+            fprintf(stream, "\n");
+            munmap(text, file_status.st_size);
+        }
+    }
+    close(fd);
+    return length;
+}
+
+/* For the provided file 'filename', this function prints the
+Caesar-encrypted text of the file. */
+void encryptCaesarFile(char *filename)
+{
+    encryptCaesarFileToStream(filename, stdout);
+}
+
+/* Writes the Caesar-encrypted 'filename' to `stream` */
+static void encryptCaesarFilenameToStream(const char *filename, FILE *stream)
+{
+    char *buffer = poolTake(MAX_FILENAME_SIZE);
+    if (buffer != NULL)
+    {
+        strlcpy(buffer, filename, MAX_FILENAME_SIZE);
+        caesar(buffer, strnlen(buffer, MAX_FILENAME_SIZE));
+        fprintf(stream, "\nEncrypted filename: %s ", buffer);
+        poolRelease(buffer);
+    }
+    else
+    {
+        fprintf(stderr, "Memory pool exhausted, skipping filename %s\n", filename);
+    }
+}
+
+/* Prints the Caesar-encrypted 'filename'.This function is responsible for
+allocating and deallocating the required buffers for storing the
+file content.
+Notes: The filename must be all capital letters and we accept that the
+'.' of the filename will also be shifted by the Caesar encryption. */
+void encryptCaesarFilename(char *filename)
+{
+    encryptCaesarFilenameToStream(filename, stdout);
+}
+
+/* Reads the file `filename` into a buffer from `allocate` (with `context`
+as first argument) and encrypts it together with its name, the way
+`encryptCaesarFile` and `encryptCaesarFilename` do. Returns the number of
+bytes or 0 if the file could not be read. */
+static size_t encryptFileWith(const char *filename, void *(*allocate)(void *context, size_t size), void *context)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    struct stat file_status;
+    size_t length = 0;
+    if (fstat(fd, &file_status) == 0 && file_status.st_size > 0)
+    {
+        char *name = allocate(context, MAX_FILENAME_SIZE);
+        char *text = allocate(context, file_status.st_size + 1);
+        ssize_t read_bytes = (name != NULL && text != NULL) ? pread(fd, text, file_status.st_size, 0) : -1;
+        if (read_bytes > 0)
+        {
+            strlcpy(name, filename, MAX_FILENAME_SIZE);
+            caesar(name, strnlen(name, MAX_FILENAME_SIZE));
+            caesar(text, read_bytes);
+            length = read_bytes;
+        }
+    }
+    close(fd);
+    return length;
+}
+
+/* Remembers the (up to two) allocations of one file in `context`, so
+that they can be freed afterwards */
+static void *benchmarkMalloc(void *context, size_t size)
+{
+    void **pointers = context;
+    void *pointer = malloc(size);
+    pointers[pointers[0] == NULL ? 0 : 1] = pointer;
+    return pointer;
+}
+
+static void *benchmarkArenaAlloc(void *context, size_t size)
+{
+    return arenaAlloc(context, size);
+}
+
+/* Runs the `encryptCaesarFile` workload (read the file into a buffer of
+its size, encrypt name and content) `rounds` times over all `count`
+files, once with malloc/free per buffer and once with an arena that is
+reset after every round. Stores the nanoseconds per file of both
+variants into `malloc_nanoseconds` and `arena_nanoseconds`. Returns
+false if the arena could not be created. */
+bool benchmarkArena(char **filenames, size_t count, int rounds, bool huge_pages, double *malloc_nanoseconds,
+                    double *arena_nanoseconds)
+{
+    Arena *arena = arenaCreate(4 * 1024 * 1024, huge_pages);
+    if (arena == NULL)
+    {
+        return false;
+    }
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            void *pointers[2] = {NULL, NULL};
+            encryptFileWith(filenames[i], benchmarkMalloc, pointers);
+            free(pointers[0]);
+            free(pointers[1]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double files = (double)rounds * count;
+    *malloc_nanoseconds = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / files;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            encryptFileWith(filenames[i], benchmarkArenaAlloc, arena);
+        }
+        arenaReset(arena);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *arena_nanoseconds = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / files;
+    arenaDestroy(arena);
+    return true;
+}
+
+////////// Parallel directory encryption //////////
+
+/* A producer thread enumerates the directory tree with getdents64 and
+hands out the regular files to a pool of workers, each owning a deque of
+tasks. A worker pops from the back of its own deque and steals from the
+front of the others when it runs dry. Every task writes into its own
+memory stream, and the calling thread prints the finished tasks in the
+order the producer found them, so that the output does not depend on the
+scheduling. The producer stays at most `ENCRYPT_TASKS_AHEAD` tasks per
+worker ahead of the printing, which bounds the buffered output when an
+early file is slow or large. */
+
+#define DIRECTORY_BUFFER_SIZE (64 * 1024)
+#define ENCRYPT_TASKS_AHEAD 4
+
+/* The record returned by the getdents64 system call */
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct
+{
+    char *path;
+    /* offset of the file name within `path` */
+    size_t name_offset;
+    char *output;
+    size_t output_size;
+    size_t bytes;
+    bool done;
+} EncryptTask;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    EncryptTask **tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} TaskDeque;
+
+/* Throughput of one `encryptDirectoryParallel` run */
+typedef struct
+{
+    size_t files;
+    size_t bytes;
+    double seconds;
+} DirectoryEncryptionStats;
+
+typedef struct
+{
+    const char *root;
+    bool recursive;
+    int thread_count;
+    TaskDeque *deques;
+    /* tasks and paths, only allocated by the producer and released together */
+    Arena *arena;
+    /* protects everything below */
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t task_done;
+    pthread_cond_t output_space;
+    /* tasks submitted but not yet taken by a worker */
+    atomic_size_t queued;
+    bool producer_done;
+    /* number of tasks printed so far and how many may be submitted beyond */
+    size_t printed;
+    size_t output_window;
+    /* all tasks in the order of enumeration */
+    EncryptTask **tasks;
+    size_t task_count;
+    size_t task_capacity;
+} EncryptEngine;
+
+typedef struct
+{
+    EncryptEngine *engine;
+    int index;
+} EncryptWorker;
+
+static bool dequePush(TaskDeque *deque, EncryptTask *task)
+{
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->tail - deque->head == deque->capacity)
+    {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+        EncryptTask **tasks = malloc(capacity * sizeof(EncryptTask *));
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&deque->mutex);
+            return false;
+        }
+        for (size_t i = deque->head; i < deque->tail; i++)
+        {
+            tasks[i - deque->head] = deque->tasks[i % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->tail++ % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->mutex);
+    return true;
+}
+
+/* The owner takes its newest task, thieves take the oldest one */
+static EncryptTask *dequeTake(TaskDeque *deque, bool steal)
+{
+    EncryptTask *task = NULL;
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->head != deque->tail)
+    {
+        if (steal)
+        {
+            task = deque->tasks[deque->head++ % deque->capacity];
+        }
+        else
+        {
+            task = deque->tasks[--deque->tail % deque->capacity];
+        }
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return task;
+}
+
+static EncryptTask *findTask(EncryptEngine *engine, int index)
+{
+    EncryptTask *task = dequeTake(&engine->deques[index], false);
+    for (int i = 1; task == NULL && i < engine->thread_count; i++)
+    {
+        task = dequeTake(&engine->deques[(index + i) % engine->thread_count], true);
+    }
+    if (task != NULL)
+    {
+        atomic_fetch_sub(&engine->queued, 1);
+    }
+    return task;
+}
+
+static void runTask(EncryptTask *task)
+{
+    FILE *stream = open_memstream(&task->output, &task->output_size);
+    if (stream != NULL)
+    {
+        encryptCaesarFilenameToStream(task->path + task->name_offset, stream);
+        task->bytes = encryptCaesarFileToStream(task->path, stream);
+        fclose(stream);
+    }
+}
+
+static void *encryptWorker(void *argument)
+{
+    EncryptWorker *worker = argument;
+    EncryptEngine *engine = worker->engine;
+    for (;;)
+    {
+        EncryptTask *task = findTask(engine, worker->index);
+        if (task == NULL)
+        {
+            pthread_mutex_lock(&engine->mutex);
+            while (atomic_load(&engine->queued) == 0 && !engine->producer_done)
+            {
+                pthread_cond_wait(&engine->work_available, &engine->mutex);
+            }
+            bool finished = (atomic_load(&engine->queued) == 0 && engine->producer_done);
+            pthread_mutex_unlock(&engine->mutex);
+            if (finished)
+            {
+                return NULL;
+            }
+            continue;
+        }
+        runTask(task);
+        pthread_mutex_lock(&engine->mutex);
+        task->done = true;
+        pthread_cond_broadcast(&engine->task_done);
+        pthread_mutex_unlock(&engine->mutex);
+    }
+}
+
+/* Records `task` in enumeration order and hands it to a worker, waiting
+while the output window is full */
+static bool submitTask(EncryptEngine *engine, EncryptTask *task)
+{
+    pthread_mutex_lock(&engine->mutex);
+    while (engine->task_count - engine->printed >= engine->output_window)
+    {
+        /* the workers may not have been woken for this batch yet */
+        pthread_cond_broadcast(&engine->work_available);
+        pthread_cond_wait(&engine->output_space, &engine->mutex);
+    }
+    if (engine->task_count == engine->task_capacity)
+    {
+        size_t capacity = engine->task_capacity ? engine->task_capacity * 2 : 1024;
+        EncryptTask **tasks = realloc(engine->tasks, capacity * sizeof(EncryptTask *));
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&engine->mutex);
+            return false;
+        }
+        engine->tasks = tasks;
+        engine->task_capacity = capacity;
+    }
+    size_t sequence = engine->task_count;
+    if (!dequePush(&engine->deques[sequence % engine->thread_count], task))
+    {
+        pthread_mutex_unlock(&engine->mutex);
+        return false;
+    }
+    engine->tasks[engine->task_count++] = task;
+    atomic_fetch_add(&engine->queued, 1);
+    pthread_mutex_unlock(&engine->mutex);
+    return true;
+}
+
+static char *joinPath(Arena *arena, const char *directory, const char *name)
+{
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+    char *path = arenaAlloc(arena, directory_length + name_length + 2);
+    if (path != NULL)
+    {
+        memcpy(path, directory, directory_length);
+        path[directory_length] = '/';
+        memcpy(path + directory_length + 1, name, name_length + 1);
+    }
+    return path;
+}
+
+/* Enumerates one directory, submitting its regular files and appending
+its subdirectories to `directories` if the engine is recursive */
+static void enumerateDirectory(EncryptEngine *engine, const char *directory, char ***directories,
+                               size_t *directory_count, size_t *directory_capacity)
+{
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+    {
+        return;
+    }
+    char *buffer = malloc(DIRECTORY_BUFFER_SIZE);
+    long read_bytes;
+    while (buffer != NULL && (read_bytes = syscall(SYS_getdents64, fd, buffer, DIRECTORY_BUFFER_SIZE)) > 0)
+    {
+        for (long offset = 0; offset < read_bytes;)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN)
+            {
+                struct stat file_status;
+                if (fstatat(fd, entry->d_name, &file_status, AT_SYMLINK_NOFOLLOW) == -1)
+                {
+                    continue;
+                }
+                type = S_ISDIR(file_status.st_mode) ? DT_DIR : S_ISREG(file_status.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type == DT_DIR && engine->recursive)
+            {
+                if (*directory_count == *directory_capacity)
+                {
+                    size_t capacity = *directory_capacity ? *directory_capacity * 2 : 64;
+                    char **grown = realloc(*directories, capacity * sizeof(char *));
+                    if (grown == NULL)
+                    {
+                        continue;
+                    }
+                    *directories = grown;
+                    *directory_capacity = capacity;
+                }
+                char *path = joinPath(engine->arena, directory, entry->d_name);
+                if (path != NULL)
+                {
+                    (*directories)[(*directory_count)++] = path;
+                }
+            }
+            else if (type == DT_REG)
+            {
+                EncryptTask *task = arenaAlloc(engine->arena, sizeof(EncryptTask));
+                char *path = joinPath(engine->arena, directory, entry->d_name);
+                if (task == NULL || path == NULL)
+                {
+                    continue;
+                }
+                memset(task, 0, sizeof(EncryptTask));
+                task->path = path;
+                task->name_offset = strlen(directory) + 1;
+                submitTask(engine, task);
+            }
+        }
+        /* wake the workers once per getdents64 batch */
+        pthread_mutex_lock(&engine->mutex);
+        pthread_cond_broadcast(&engine->work_available);
+        pthread_mutex_unlock(&engine->mutex);
+    }
+    free(buffer);
+    close(fd);
+}
+
+static void *enumerateEntries(void *argument)
+{
+    EncryptEngine *engine = argument;
+    char **directories = NULL;
+    size_t directory_count = 0;
+    size_t directory_capacity = 0;
+    /* depth-first, in the order getdents64 returns the entries */
+    enumerateDirectory(engine, engine->root, &directories, &directory_count, &directory_capacity);
+    while (directory_count > 0)
+    {
+        char *directory = directories[--directory_count];
+        enumerateDirectory(engine, directory, &directories, &directory_count, &directory_capacity);
+    }
+    free(directories);
+    pthread_mutex_lock(&engine->mutex);
+    engine->producer_done = true;
+    pthread_cond_broadcast(&engine->work_available);
+    pthread_cond_broadcast(&engine->task_done);
+    pthread_mutex_unlock(&engine->mutex);
+    return NULL;
+}
+
+/* Prints the encrypted names and contents of all regular files in
+`directory` (and its subdirectories if `recursive` is set) using
+`thread_count` workers (0 means one per online CPU). The output order is
+the enumeration order, independent of the number of threads. The
+throughput is stored in `stats` if it is not NULL. Returns false if the
+threads could not be started. */
+bool encryptDirectoryParallel(const char *directory, bool recursive, int thread_count,
+                              DirectoryEncryptionStats *stats)
+{
+    if (thread_count <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cpus > 0 ? (int)cpus : 1;
+    }
+    EncryptEngine engine = {.root = directory,
+                            .recursive = recursive,
+                            .thread_count = thread_count,
+                            .output_window = (size_t)thread_count * ENCRYPT_TASKS_AHEAD};
+    engine.deques = calloc(thread_count, sizeof(TaskDeque));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    EncryptWorker *workers = calloc(thread_count, sizeof(EncryptWorker));
+    engine.arena = arenaCreate(1024 * 1024, false);
+    if (engine.deques == NULL || threads == NULL || workers == NULL || engine.arena == NULL)
+    {
+        arenaDestroy(engine.arena);
+        free(engine.deques);
+        free(threads);
+        free(workers);
+        return false;
+    }
+    pthread_mutex_init(&engine.mutex, NULL);
+    pthread_cond_init(&engine.work_available, NULL);
+    pthread_cond_init(&engine.task_done, NULL);
+    pthread_cond_init(&engine.output_space, NULL);
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_init(&engine.deques[i].mutex, NULL);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t producer;
+    bool success = (pthread_create(&producer, NULL, enumerateEntries, &engine) == 0);
+    int started = 0;
+    for (; success && started < thread_count; started++)
+    {
+        workers[started] = (EncryptWorker){.engine = &engine, .index = started};
+        if (pthread_create(&threads[started], NULL, encryptWorker, &workers[started]) != 0)
+        {
+            break;
+        }
+    }
+    if (success && started == 0)
+    {
+        /* without workers, the tasks are run by this thread below, so the
+        producer must not wait for them */
+        pthread_mutex_lock(&engine.mutex);
+        engine.output_window = SIZE_MAX;
+        pthread_cond_broadcast(&engine.output_space);
+        pthread_mutex_unlock(&engine.mutex);
+        pthread_join(producer, NULL);
+    }
+
+    /* print the finished tasks in enumeration order */
+    size_t files = 0;
+    size_t bytes = 0;
+    for (size_t next = 0; success; next++)
+    {
+        pthread_mutex_lock(&engine.mutex);
+        engine.printed = next;
+        pthread_cond_broadcast(&engine.output_space);
+        while ((next == engine.task_count && !engine.producer_done) ||
+               (next < engine.task_count && !engine.tasks[next]->done && started > 0))
+        {
+            pthread_cond_wait(&engine.task_done, &engine.mutex);
+        }
+        EncryptTask *task = next < engine.task_count ? engine.tasks[next] : NULL;
+        pthread_mutex_unlock(&engine.mutex);
+        if (task == NULL)
+        {
+            break;
+        }
+        if (started == 0)
+        {
+            runTask(task);
+        }
+        if (task->output != NULL)
+        {
+            fwrite(task->output, 1, task->output_size, stdout);
+        }
+        files++;
+        bytes += task->bytes;
+        free(task->output);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (success)
+    {
+        if (started > 0)
+        {
+            pthread_join(producer, NULL);
+        }
+        for (int i = 0; i < started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    if (stats != NULL)
+    {
+        stats->files = files;
+        stats->bytes = bytes;
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_destroy(&engine.deques[i].mutex);
+        free(engine.deques[i].tasks);
+    }
+    pthread_cond_destroy(&engine.output_space);
+    pthread_cond_destroy(&engine.task_done);
+    pthread_cond_destroy(&engine.work_available);
+    pthread_mutex_destroy(&engine.mutex);
+    free(engine.tasks);
+    arenaDestroy(engine.arena);
+    free(engine.deques);
+    free(threads);
+    free(workers);
+    return success;
+}
+
+/* For all files in the current directory, this function reads text from the
+file and prints the Caesar-encrypted text, followed by the throughput. */
+void encryptDirectoryContent()
+{
+    DirectoryEncryptionStats stats;
+    if (encryptDirectoryParallel(".", false, 0, &stats))
+    {
+        printf("\nEncrypted %zu files (%zu bytes) in %.3f s: %.0f files/s, %.1f MB/s\n", stats.files, stats.bytes,
+               stats.seconds, stats.files / stats.seconds, stats.bytes / stats.seconds / 1e6);
+    }
+}
+
+////////// Asynchronous file pipeline //////////
+
+/* Encrypts many files with a read -> encrypt -> write pipeline. Reads and
+writes go through io_uring into a bounded set of registered buffers taken
+from the memory pool, so that the kernel reads the next chunks (of this or
+the next files) while the current chunk is encrypted. Without io_uring
+(old kernels, seccomp), the same work is done with pread/pwrite. */
+
+#define PIPELINE_BUFFER_SIZE (512 * 1024)
+#define PIPELINE_BUFFERS 16
+/* number of files that are open at the same time */
+#define PIPELINE_ACTIVE_FILES 8
+/* every buffer and every open can be in flight at once */
+#define PIPELINE_RING_ENTRIES 64
+
+/* Result of one `encryptFilesPipelined` run */
+typedef struct
+{
+    size_t files;
+    size_t failed_files;
+    size_t bytes;
+    double seconds;
+    bool used_io_uring;
+} PipelineStats;
+
+typedef struct
+{
+    int source_fd;
+    int destination_fd;
+    off_t next_offset;
+    size_t bytes;
+    int opens_pending;
+    int in_flight;
+    bool started;
+    bool end_of_file;
+    bool failed;
+    bool finished;
+} PipelineFile;
+
+typedef struct
+{
+    char *memory;
+    size_t file;
+    off_t offset;
+    /* bytes read into the chunk so far */
+    size_t length;
+} PipelineBuffer;
+
+/* Encrypts one file with blocking pread/pwrite through `buffer` */
+static bool encryptFileBlocking(const char *source, const char *destination, char *buffer, int key, CaesarMode mode,
+                                size_t *bytes)
+{
+    int source_fd = open(source, O_RDONLY);
+    if (source_fd == -1)
+    {
+        return false;
+    }
+    int destination_fd = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool success = (destination_fd != -1);
+    for (off_t offset = 0; success;)
+    {
+        ssize_t read_bytes = pread(source_fd, buffer, PIPELINE_BUFFER_SIZE, offset);
+        if (read_bytes <= 0)
+        {
+            success = (read_bytes == 0);
+            break;
+        }
+        caesarEncrypt(buffer, read_bytes, key, mode);
+        for (ssize_t written = 0; success && written < read_bytes;)
+        {
+            ssize_t result = pwrite(destination_fd, buffer + written, read_bytes - written, offset + written);
+            success = (result > 0);
+            written += result;
+        }
+        offset += read_bytes;
+        *bytes += read_bytes;
+    }
+    if (destination_fd != -1 && close(destination_fd) == -1)
+    {
+        success = false;
+    }
+    close(source_fd);
+    return success;
+}
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+enum
+{
+    PIPELINE_OPEN_SOURCE,
+    PIPELINE_OPEN_DESTINATION,
+    PIPELINE_READ,
+    PIPELINE_WRITE
+};
+
+/* The submission and completion rings shared with the kernel */
+typedef struct
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+    /* requests submitted to the kernel whose completion was not reaped yet */
+    unsigned in_flight;
+} IoRing;
+
+static void ringDestroy(IoRing *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+}
+
+static bool ringCreate(IoRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd == -1)
+    {
+        return false;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+        {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        ringDestroy(ring);
+        return false;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        ringDestroy(ring);
+        return false;
+    }
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head = (_Atomic unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/* Queues one request. The pipeline never has more requests in flight than
+the ring has entries, so there is always a free slot. */
+static struct io_uring_sqe *ringQueue(IoRing *ring, uint8_t opcode, int fd, const void *address, unsigned length,
+                                      off_t offset, uint64_t user_data)
+{
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)address;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    ring->to_submit++;
+    return sqe;
+}
+
+/* Submits the queued requests and waits for at least one completion */
+static bool ringSubmitAndWait(IoRing *ring)
+{
+    for (;;)
+    {
+        int result = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (result >= 0)
+        {
+            ring->to_submit -= result;
+            ring->in_flight += result;
+            return true;
+        }
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+/* Returns true if the kernel supports all `count` `opcodes`. The probe
+itself only exists since Linux 5.6, which is also the first version with
+IORING_OP_OPENAT, so older kernels fail here. */
+static bool ringSupports(IoRing *ring, const uint8_t *opcodes, int count)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    bool supported = (probe != NULL && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0);
+    for (int i = 0; supported && i < count; i++)
+    {
+        supported = opcodes[i] <= probe->last_op && (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+static uint64_t pipelineTag(int kind, size_t index)
+{
+    return ((uint64_t)index << 2) | kind;
+}
+
+static void finishPipelineFile(PipelineFile *file, PipelineStats *stats)
+{
+    if (file->source_fd != -1)
+    {
+        close(file->source_fd);
+    }
+    if (file->destination_fd != -1 && close(file->destination_fd) == -1)
+    {
+        file->failed = true;
+    }
+    file->finished = true;
+    stats->files++;
+    stats->bytes += file->bytes;
+    if (file->failed)
+    {
+        stats->failed_files++;
+    }
+}
+
+/* Reaps the completions of all submitted requests without starting new
+ones, keeping the descriptors of completed opens so that they are closed.
+Returns false if io_uring_enter keeps failing. */
+static bool drainPipeline(IoRing *ring, PipelineFile *files)
+{
+    while (ring->in_flight > 0)
+    {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            return false;
+        }
+        unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+        ring->in_flight -= tail - head;
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            int kind = cqe->user_data & 3;
+            size_t index = cqe->user_data >> 2;
+            if (kind == PIPELINE_OPEN_SOURCE && cqe->res >= 0)
+            {
+                files[index].source_fd = cqe->res;
+            }
+            else if (kind == PIPELINE_OPEN_DESTINATION && cqe->res >= 0)
+            {
+                files[index].destination_fd = cqe->res;
+            }
+        }
+        atomic_store_explicit(ring->cq_head, head, memory_order_release);
+    }
+    return true;
+}
+
+/* Runs the pipeline on io_uring. Returns false if io_uring is not usable,
+before any file has been touched. */
+static bool encryptFilesUring(char **sources, char **destinations, size_t count, int key, CaesarMode mode,
+                              PipelineBuffer *buffers, PipelineStats *stats)
+{
+    IoRing ring;
+    if (!ringCreate(&ring, PIPELINE_RING_ENTRIES))
+    {
+        return false;
+    }
+    struct iovec vectors[PIPELINE_BUFFERS];
+    for (int i = 0; i < PIPELINE_BUFFERS; i++)
+    {
+        vectors[i] = (struct iovec){.iov_base = buffers[i].memory, .iov_len = PIPELINE_BUFFER_SIZE};
+    }
+    static const uint8_t opcodes[] = {IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED};
+    PipelineFile *files = calloc(count, sizeof(PipelineFile));
+    if (files == NULL || !ringSupports(&ring, opcodes, sizeof(opcodes)) ||
+        syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, vectors, PIPELINE_BUFFERS))
+    {
+        free(files);
+        ringDestroy(&ring);
+        return false;
+    }
+    stats->used_io_uring = true;
+
+    int free_buffers[PIPELINE_BUFFERS];
+    int free_count = PIPELINE_BUFFERS;
+    for (int i = 0; i < PIPELINE_BUFFERS; i++)
+    {
+        free_buffers[i] = i;
+    }
+    size_t next_file = 0;
+    size_t active = 0;
+    size_t first_unfinished = 0;
+    while (first_unfinished < count)
+    {
+        /* open the next files while there is room */
+        for (; active < PIPELINE_ACTIVE_FILES && next_file < count; next_file++, active++)
+        {
+            PipelineFile *file = &files[next_file];
+            *file = (PipelineFile){.source_fd = -1, .destination_fd = -1, .opens_pending = 2, .started = true};
+            struct io_uring_sqe *sqe = ringQueue(&ring, IORING_OP_OPENAT, AT_FDCWD, sources[next_file], 0, 0,
+                                                 pipelineTag(PIPELINE_OPEN_SOURCE, next_file));
+            sqe->open_flags = O_RDONLY;
+            sqe = ringQueue(&ring, IORING_OP_OPENAT, AT_FDCWD, destinations[next_file], 0644, 0,
+                            pipelineTag(PIPELINE_OPEN_DESTINATION, next_file));
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        /* read ahead into the free buffers, oldest files first */
+        for (size_t i = first_unfinished; i < next_file && free_count > 0; i++)
+        {
+            PipelineFile *file = &files[i];
+            while (!file->finished && file->opens_pending == 0 && !file->end_of_file && !file->failed &&
+                   free_count > 0 && file->in_flight < PIPELINE_BUFFERS / 2)
+            {
+                int index = free_buffers[--free_count];
+                buffers[index].file = i;
+                buffers[index].offset = file->next_offset;
+                buffers[index].length = 0;
+                struct io_uring_sqe *sqe = ringQueue(&ring, IORING_OP_READ_FIXED, file->source_fd,
+                                                     buffers[index].memory, PIPELINE_BUFFER_SIZE, file->next_offset,
+                                                     pipelineTag(PIPELINE_READ, index));
+                sqe->buf_index = index;
+                file->next_offset += PIPELINE_BUFFER_SIZE;
+                file->in_flight++;
+            }
+        }
+        if (!ringSubmitAndWait(&ring))
+        {
+            break;
+        }
+
+        unsigned head = atomic_load_explicit(ring.cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(ring.cq_tail, memory_order_acquire);
+        ring.in_flight -= tail - head;
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            int kind = cqe->user_data & 3;
+            size_t index = cqe->user_data >> 2;
+            int result = cqe->res;
+            if (kind == PIPELINE_OPEN_SOURCE || kind == PIPELINE_OPEN_DESTINATION)
+            {
+                PipelineFile *file = &files[index];
+                file->opens_pending--;
+                if (result < 0)
+                {
+                    file->failed = true;
+                }
+                else if (kind == PIPELINE_OPEN_SOURCE)
+                {
+                    file->source_fd = result;
+                }
+                else
+                {
+                    file->destination_fd = result;
+                }
+                continue;
+            }
+            PipelineBuffer *buffer = &buffers[index];
+            PipelineFile *file = &files[buffer->file];
+            if (kind == PIPELINE_READ && result > 0 && !file->failed &&
+                buffer->length + result < PIPELINE_BUFFER_SIZE)
+            {
+                /* a short read: the read-ahead already claimed the following
+                chunk, so fetch the rest of this one (a read of 0 bytes then
+                marks the end of the file) */
+                buffer->length += result;
+                struct io_uring_sqe *sqe =
+                    ringQueue(&ring, IORING_OP_READ_FIXED, file->source_fd, buffer->memory + buffer->length,
+                              PIPELINE_BUFFER_SIZE - buffer->length, buffer->offset + buffer->length,
+                              pipelineTag(PIPELINE_READ, index));
+                sqe->buf_index = index;
+                continue;
+            }
+            if (kind == PIPELINE_READ && result >= 0 && buffer->length + result > 0 && !file->failed)
+            {
+                if (result == 0)
+                {
+                    file->end_of_file = true;
+                }
+                /* encrypting this chunk overlaps with the reads still in flight */
+                buffer->length += result;
+                caesarEncrypt(buffer->memory, buffer->length, key, mode);
+                struct io_uring_sqe *sqe = ringQueue(&ring, IORING_OP_WRITE_FIXED, file->destination_fd,
+                                                     buffer->memory, buffer->length, buffer->offset,
+                                                     pipelineTag(PIPELINE_WRITE, index));
+                sqe->buf_index = index;
+                continue;
+            }
+            if (kind == PIPELINE_READ)
+            {
+                file->end_of_file = true;
+                file->failed |= (result < 0);
+            }
+            else if (result != (int)buffer->length)
+            {
+                file->failed = true;
+            }
+            else
+            {
+                file->bytes += result;
+            }
+            file->in_flight--;
+            free_buffers[free_count++] = index;
+        }
+        atomic_store_explicit(ring.cq_head, head, memory_order_release);
+
+        /* close the files whose requests have all completed */
+        for (size_t i = first_unfinished; i < next_file; i++)
+        {
+            PipelineFile *file = &files[i];
+            if (!file->finished && file->opens_pending == 0 && file->in_flight == 0 &&
+                (file->end_of_file || file->failed))
+            {
+                finishPipelineFile(file, stats);
+                active--;
+            }
+        }
+        while (first_unfinished < next_file && files[first_unfinished].finished)
+        {
+            first_unfinished++;
+        }
+    }
+    /* only reached early if io_uring_enter failed: the requests already
+    submitted may still target the registered buffers, so wait for them
+    before the buffers go back to the pool, then give up on the remaining
+    files */
+    if (!drainPipeline(&ring, files))
+    {
+        /* the kernel may still write into the buffers, so never reuse them */
+        for (int i = 0; i < PIPELINE_BUFFERS; i++)
+        {
+            buffers[i].memory = NULL;
+        }
+    }
+    for (size_t i = first_unfinished; i < count; i++)
+    {
+        if (!files[i].finished)
+        {
+            if (!files[i].started)
+            {
+                files[i] = (PipelineFile){.source_fd = -1, .destination_fd = -1};
+            }
+            files[i].failed = true;
+            finishPipelineFile(&files[i], stats);
+        }
+    }
+    free(files);
+    ringDestroy(&ring);
+    return true;
+}
+#endif
+
+/* Encrypts the files `sources[i]` into `destinations[i]` for all `count`
+files with the provided `key` and `mode`, using io_uring if the kernel
+offers it and blocking pread/pwrite otherwise. The statistics (including
+which variant ran) are stored in `stats` if it is not NULL. Returns false
+if one of the files could not be encrypted. */
+bool encryptFilesPipelined(char **sources, char **destinations, size_t count, int key, CaesarMode mode,
+                           PipelineStats *stats)
+{
+    PipelineStats local_stats = {0};
+    PipelineBuffer buffers[PIPELINE_BUFFERS] = {{0}};
+    for (int i = 0; i < PIPELINE_BUFFERS; i++)
+    {
+        buffers[i].memory = poolTake(PIPELINE_BUFFER_SIZE);
+        if (buffers[i].memory == NULL)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                poolRelease(buffers[j].memory);
+            }
+            return false;
+        }
+    }
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool done = false;
+#ifdef __NR_io_uring_setup
+    done = encryptFilesUring(sources, destinations, count, key, mode, buffers, &local_stats);
+#endif
+    for (size_t i = 0; !done && i < count; i++)
+    {
+        local_stats.files++;
+        if (!encryptFileBlocking(sources[i], destinations[i], buffers[0].memory, key, mode, &local_stats.bytes))
+        {
+            local_stats.failed_files++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    local_stats.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    for (int i = 0; i < PIPELINE_BUFFERS; i++)
+    {
+        poolRelease(buffers[i].memory);
+    }
+    if (stats != NULL)
+    {
+        *stats = local_stats;
+    }
+    return local_stats.failed_files == 0;
+}
@@ -1,27 +1,56 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 
 #define ELEMENT_SIZE 255
+/* number of pool elements, can be raised at compile time (e.g. -DMAX_ELEMENTS=4096) */
+#ifndef MAX_ELEMENTS
 #define MAX_ELEMENTS 10
+#endif
 typedef struct
 {
-    bool occupied;
     char memory[ELEMENT_SIZE];
+    atomic_bool occupied;
+    /* index + 1 of the next free element while this one is in the free list */
+    atomic_uint next_free;
 } PoolElement;
 
 static PoolElement memory_pool[MAX_ELEMENTS];
 
+/* Lock-free stack of released elements. The lower 32 bits hold the index + 1
+of the top element (0 if empty), the upper 32 bits a counter that changes
+with every update, so that a concurrent pop/push sequence cannot make a
+compare-and-swap succeed on a stale top element (ABA problem). */
+static atomic_uint_least64_t pool_free_list;
+/* elements from this index on have never been taken, so the pool needs no
+initialization before the first `poolTake` */
+static atomic_uint pool_untouched;
+
 void *poolTake(size_t size)
 {
     if (size <= ELEMENT_SIZE)
     {
-        for (int i = 0; i < MAX_ELEMENTS; i++)
+        uint64_t head = atomic_load(&pool_free_list);
+        while ((uint32_t)head != 0)
+        {
+            PoolElement *element = &memory_pool[(uint32_t)head - 1];
+            uint64_t next = ((head >> 32) + 1) << 32 | atomic_load(&element->next_free);
+            if (atomic_compare_exchange_weak(&pool_free_list, &head, next))
+            {
+                atomic_store(&element->occupied, true);
+                return &(element->memory);
+            }
+        }
+        unsigned untouched = atomic_load(&pool_untouched);
+        while (untouched < MAX_ELEMENTS)
         {
-            if (memory_pool[i].occupied == false)
+            if (atomic_compare_exchange_weak(&pool_untouched, &untouched, untouched + 1))
             {
-                memory_pool[i].occupied = true;
-                return &(memory_pool[i].memory);
+                atomic_store(&memory_pool[untouched].occupied, true);
+                return &(memory_pool[untouched].memory);
             }
         }
     }
@@ -30,14 +59,25 @@ void *poolTake(size_t size)
 
 void poolRelease(void *pointer)
 {
-    for (int i = 0; i < MAX_ELEMENTS; i++)
+    /* the element is found by address arithmetic instead of searching for it */
+    uintptr_t offset = (uintptr_t)pointer - (uintptr_t)memory_pool;
+    if ((uintptr_t)pointer < (uintptr_t)memory_pool || offset >= sizeof(memory_pool) ||
+        offset % sizeof(PoolElement) != offsetof(PoolElement, memory))
     {
-        if (&(memory_pool[i].memory) == pointer)
-        {
-            memory_pool[i].occupied = false;
-            return;
-        }
+        return;
     }
+    uint32_t index = offset / sizeof(PoolElement);
+    PoolElement *element = &memory_pool[index];
+    if (!atomic_exchange(&element->occupied, false))
+    {
+        /* released twice */
+        return;
+    }
+    uint64_t head = atomic_load(&pool_free_list);
+    do
+    {
+        atomic_store(&element->next_free, (uint32_t)head);
+    } while (!atomic_compare_exchange_weak(&pool_free_list, &head, ((head >> 32) + 1) << 32 | (index + 1)));
 }
 
 #define MAX_FILENAME_SIZE ELEMENT_SIZE
@@ -1,5 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 // Ethernet driver API
 
@@ -24,6 +39,41 @@ struct EthernetDriverStat
 /* Returns statistics information of the Ethernet driver */
 struct EthernetDriverStat ethernetDriverGetStatistics();
 
+/* Maximum number of receive/transmit queues of the driver */
+#define ETHERNET_MAX_QUEUES 8
+
+enum EthernetDropReason
+{
+    ETHERNET_DROP_RX_RING_FULL, /* the caller did not release receive slots fast enough */
+    ETHERNET_DROP_TOO_LONG,     /* the frame's payload was longer than the MTU */
+    ETHERNET_DROP_NO_BUFFER,    /* the packet pool had no memory left */
+    ETHERNET_DROP_REASONS
+};
+
+struct EthernetQueueStat
+{
+    uint64_t received_packets;
+    uint64_t received_bytes;
+    uint64_t sent_packets;
+    uint64_t sent_bytes;
+};
+
+struct EthernetDriverStatExtended
+{
+    uint64_t received_packets;
+    uint64_t received_bytes;
+    uint64_t total_sent_packets;
+    uint64_t successfully_sent_packets;
+    uint64_t failed_sent_packets;
+    uint64_t sent_bytes;
+    uint64_t dropped_packets[ETHERNET_DROP_REASONS];
+    struct EthernetQueueStat queues[ETHERNET_MAX_QUEUES];
+};
+/* Stores the 64-bit statistics of the Ethernet driver into 'stat', which
+has to be provided by the caller. Every packet is either fully counted in
+it or not at all; reading never blocks the sending or receiving threads. */
+void ethernetDriverGetStatisticsExtended(struct EthernetDriverStatExtended *stat);
+
 struct IpAddress
 {
     char address[16];
@@ -33,24 +83,1135 @@ struct IpAddress
 by the caller*/
 void ethernetDriverGetIp(struct IpAddress *ip);
 
+/* Maximum MTU (jumbo frames) and the free space kept in front of and
+behind the data of every packet for adding headers and trailers */
+#define PACKET_MAX_MTU 9000
+/* The MTU limits the payload; a frame may be longer by its Ethernet
+header and an optional 802.1Q VLAN tag */
+#define ETHERNET_HEADER_SIZE 14
+#define ETHERNET_VLAN_TAG_SIZE 4
+#define PACKET_HEADROOM 64
+#define PACKET_TAILROOM 32
+
+/* A reference-counted packet buffer from the driver's packet pool. Its
+size class is the smallest that fits the frame, so a small frame does not
+occupy a buffer for the maximum MTU. */
 struct Packet
 {
-    char data[1500]; /* maximum 1500 byte per packet */
+    char *data; /* start of the data within `buffer` */
     int size;
     /* actual size of data in the packet */
+    int capacity;  /* bytes in `buffer` */
+    int size_class;
+    unsigned index; /* within its size class */
+    atomic_int references;
+    atomic_uint next_free; /* index + 1 of the next free packet while in the pool */
+    _Alignas(64) char buffer[];
 };
-/* Returns a pointer to a packet that has to be freed by the caller */
+/* Returns a pointer to the next received packet (or NULL if there is
+none) that has to be released with `packetRelease` by the caller */
 struct Packet *ethernetDriverGetPacket();
 
+/* Returns an empty packet with room for `size` bytes of data (and the
+headroom and tailroom) and one reference, or NULL if no memory is left */
+struct Packet *packetAlloc(int size);
+/* Adds a reference to `packet`, for example to keep it after handing it on */
+void packetRetain(struct Packet *packet);
+/* Drops a reference to `packet`; the last one returns it to the pool */
+void packetRelease(struct Packet *packet);
+/* Prepends `bytes` bytes to the data of `packet` (which must not be
+shared) and returns the new start of the data, or NULL if the headroom is
+too small */
+char *packetPush(struct Packet *packet, int bytes);
+/* Appends `bytes` bytes to the data of `packet` (which must not be shared)
+and returns where they start, or NULL if the tailroom is too small */
+char *packetPut(struct Packet *packet, int bytes);
+
+/* Sets the MTU, the largest payload of a received frame, from 68 up to
+`PACKET_MAX_MTU` bytes. Returns false if `mtu` is out of range. */
+bool ethernetDriverSetMtu(int mtu);
+int ethernetDriverGetMtu();
+
+/* Stores pointers to up to `max` received packets into `slots` and
+returns their number (0 if no packet is waiting). The caller owns one
+reference to each packet and hands it back with `packetRelease` or
+`ethernetDriverReleaseBurst`, in any order. */
+int ethernetDriverRecvBurst(struct Packet *slots[], int max);
+/* Releases the first `count` packets of `slots` */
+void ethernetDriverReleaseBurst(struct Packet *slots[], int count);
+
+/* One contiguous piece of a packet (for example a header or the payload) */
+struct PacketSegment
+{
+    const void *data;
+    size_t length;
+};
+
+/* A packet to send, made of `segment_count` segments that are sent one
+after the other without first being copied together */
+struct PacketView
+{
+    const struct PacketSegment *segments;
+    int segment_count;
+};
+
+/* Sends the `n` packets of `pkts` and returns the number of packets that
+were sent (always the first ones). The packets can be reused as soon as
+the function returns. */
+int ethernetDriverSendBurst(const struct PacketView *pkts, int n);
+
+/* Where the driver sends the packets to. `transmit` sends the first
+packets of `pkts` and returns how many it sent. */
+struct EthernetBackend
+{
+    const char *name;
+    int (*transmit)(const struct PacketView *pkts, int n);
+};
+/* Selects the backend used by `ethernetDriverSendBurst` (by default the
+loopback backend, which receives every sent packet in the receive ring) */
+void ethernetDriverSetBackend(const struct EthernetBackend *backend);
+
+/* Returns a file descriptor (for poll/select/epoll) that becomes readable
+when received packets are waiting, or -1 if it could not be created. The
+driver signals it after `packets` packets or `microseconds` after the
+first packet not signaled yet, whatever comes first (see
+`ethernetDriverSetRxCoalescing`). */
+int ethernetDriverGetRxEventFd();
+/* Resets the event file descriptor. Call it when it became readable,
+before taking all waiting packets with `ethernetDriverRecvBurst`. */
+void ethernetDriverAckRxEvent();
+/* Sets after how many `packets` (at least 1) or `microseconds` (0 means
+immediately) waiting packets are signaled */
+void ethernetDriverSetRxCoalescing(int packets, int microseconds);
+
+/* Spreads received IPv4 packets over `count` receive queues (1 up to
+`ETHERNET_MAX_QUEUES`, only to be changed while no packets are received),
+so that all packets of a flow end up in the same queue. Every queue is
+meant to be emptied by its own consumer thread. The functions without
+queue parameter work on queue 0. Returns false if `count` is out of
+range. */
+bool ethernetDriverSetRxQueues(int count);
+int ethernetDriverGetRxQueues();
+/* Like `ethernetDriverRecvBurst` for the receive queue `queue` */
+int ethernetDriverRecvBurstQueue(int queue, struct Packet *slots[], int max);
+/* Like `ethernetDriverGetRxEventFd` for the receive queue `queue` */
+int ethernetDriverGetRxQueueEventFd(int queue);
+/* Like `ethernetDriverAckRxEvent` for the receive queue `queue` */
+void ethernetDriverAckRxQueueEvent(int queue);
+
+/* The driver always records the last received packets of every receive
+queue (by default 1024, truncated to 128 bytes). This sets the number of
+`packets` per queue (0 switches capturing off) and the `snap_length` they
+are truncated to; only to be changed while no packets are received.
+Returns false if the values are out of range or no memory is left. */
+bool ethernetDriverSetCapture(int packets, int snap_length);
+/* Writes the recorded packets of all queues in the order of their
+timestamps to the pcap file `filename` while the driver keeps running.
+Returns the number of packets written or -1. */
+long ethernetDriverExportCapture(const char *filename);
+
+// Ethernet driver implementation
+
+/* Every thread that sends or receives counts into its own cache-line
+aligned slot, so the counters of different cores never share a cache
+line. Reading adds up all slots. A sequence number per slot (odd while
+the slot is being updated) lets the reader retry instead of seeing half
+of a packet's counters. */
+#define ETHERNET_STAT_SLOTS 64
+
+enum StatCounter
+{
+    STAT_RECEIVED_PACKETS,
+    STAT_RECEIVED_BYTES,
+    STAT_TOTAL_SENT_PACKETS,
+    STAT_SUCCESSFULLY_SENT_PACKETS,
+    STAT_FAILED_SENT_PACKETS,
+    STAT_SENT_BYTES,
+    STAT_DROPPED,
+    /* followed by the 4 counters of every queue in the order of `struct EthernetQueueStat` */
+    STAT_QUEUES = STAT_DROPPED + ETHERNET_DROP_REASONS,
+    STAT_COUNTERS = STAT_QUEUES + 4 * ETHERNET_MAX_QUEUES
+};
+
+struct StatSlot
+{
+    _Alignas(64) atomic_uint sequence;
+    atomic_uint_least64_t counters[STAT_COUNTERS];
+};
+
+static struct StatSlot stat_slots[ETHERNET_STAT_SLOTS];
+static atomic_uint stat_next_slot;
+static _Thread_local struct StatSlot *stat_slot;
+
+/* Starts an update of the calling thread's slot. With more threads than
+slots, threads share slots; the counts stay exact, only a reader may then
+see a packet half-counted. */
+static struct StatSlot *statBegin()
+{
+    if (stat_slot == NULL)
+    {
+        stat_slot = &stat_slots[atomic_fetch_add(&stat_next_slot, 1) % ETHERNET_STAT_SLOTS];
+    }
+    atomic_fetch_add_explicit(&stat_slot->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return stat_slot;
+}
+
+static void statAdd(struct StatSlot *slot, int counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(&slot->counters[counter], value, memory_order_relaxed);
+}
+
+static void statEnd(struct StatSlot *slot)
+{
+    atomic_fetch_add_explicit(&slot->sequence, 1, memory_order_release);
+}
+
+static void statCountReceived(int queue, uint64_t packets, uint64_t bytes)
+{
+    struct StatSlot *slot = statBegin();
+    statAdd(slot, STAT_RECEIVED_PACKETS, packets);
+    statAdd(slot, STAT_RECEIVED_BYTES, bytes);
+    statAdd(slot, STAT_QUEUES + 4 * queue + 0, packets);
+    statAdd(slot, STAT_QUEUES + 4 * queue + 1, bytes);
+    statEnd(slot);
+}
+
+static void statCountDropped(enum EthernetDropReason reason)
+{
+    struct StatSlot *slot = statBegin();
+    statAdd(slot, STAT_DROPPED + reason, 1);
+    statEnd(slot);
+}
+
+void ethernetDriverGetStatisticsExtended(struct EthernetDriverStatExtended *stat)
+{
+    uint64_t totals[STAT_COUNTERS] = {0};
+    for (int i = 0; i < ETHERNET_STAT_SLOTS; i++)
+    {
+        struct StatSlot *slot = &stat_slots[i];
+        uint64_t values[STAT_COUNTERS];
+        unsigned before;
+        unsigned after;
+        do
+        {
+            before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+            for (int j = 0; j < STAT_COUNTERS; j++)
+            {
+                values[j] = atomic_load_explicit(&slot->counters[j], memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            after = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        for (int j = 0; j < STAT_COUNTERS; j++)
+        {
+            totals[j] += values[j];
+        }
+    }
+    stat->received_packets = totals[STAT_RECEIVED_PACKETS];
+    stat->received_bytes = totals[STAT_RECEIVED_BYTES];
+    stat->total_sent_packets = totals[STAT_TOTAL_SENT_PACKETS];
+    stat->successfully_sent_packets = totals[STAT_SUCCESSFULLY_SENT_PACKETS];
+    stat->failed_sent_packets = totals[STAT_FAILED_SENT_PACKETS];
+    stat->sent_bytes = totals[STAT_SENT_BYTES];
+    for (int i = 0; i < ETHERNET_DROP_REASONS; i++)
+    {
+        stat->dropped_packets[i] = totals[STAT_DROPPED + i];
+    }
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        stat->queues[i].received_packets = totals[STAT_QUEUES + 4 * i + 0];
+        stat->queues[i].received_bytes = totals[STAT_QUEUES + 4 * i + 1];
+        stat->queues[i].sent_packets = totals[STAT_QUEUES + 4 * i + 2];
+        stat->queues[i].sent_bytes = totals[STAT_QUEUES + 4 * i + 3];
+    }
+}
+
+struct EthernetDriverStat ethernetDriverGetStatistics()
+{
+    struct EthernetDriverStatExtended extended;
+    ethernetDriverGetStatisticsExtended(&extended);
+    struct EthernetDriverStat stat;
+    stat.received_packets = (int)extended.received_packets;
+    stat.total_sent_packets = (int)extended.total_sent_packets;
+    stat.successfully_sent_packets = (int)extended.successfully_sent_packets;
+    stat.failed_sent_packets = (int)extended.failed_sent_packets;
+    return stat;
+}
+
+/* The packet pool keeps one free list per power-of-two size class (the
+size including the `struct Packet` header), from 256 bytes up to the
+class that fits a maximum-MTU frame. The classes grow by chunks and never
+give memory back. */
+#define PACKET_MIN_SHIFT 8
+#define PACKET_MAX_SHIFT 14
+#define PACKET_CLASSES (PACKET_MAX_SHIFT - PACKET_MIN_SHIFT + 1)
+#define PACKET_CHUNK_SIZE (64 * 1024)
+/* upper limit for the memory of all classes together */
+#define PACKET_POOL_MAX_BYTES ((size_t)64 * 1024 * 1024)
+#define PACKET_MAX_CHUNKS (PACKET_POOL_MAX_BYTES / PACKET_CHUNK_SIZE)
+
+struct PacketClass
+{
+    /* Lock-free stack of free packets, so that the receive path and the
+    consumers of all queues never wait for each other. The lower 32 bits
+    hold the index + 1 of the top packet (0 if empty), the upper 32 bits a
+    counter that changes with every update, so that a concurrent pop/push
+    sequence cannot make a compare-and-swap succeed on a stale top packet
+    (ABA problem). */
+    atomic_uint_least64_t free_list;
+    atomic_uint chunk_count;
+    _Atomic(char *) chunks[PACKET_MAX_CHUNKS];
+};
+
+static struct PacketClass packet_classes[PACKET_CLASSES];
+/* growing is rare, so all classes share one lock for it */
+static pthread_mutex_t packet_grow_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t packet_pool_bytes;
+static atomic_int ethernet_mtu = 1500;
+
+bool ethernetDriverSetMtu(int mtu)
+{
+    if (mtu < 68 || mtu > PACKET_MAX_MTU)
+    {
+        return false;
+    }
+    atomic_store(&ethernet_mtu, mtu);
+    return true;
+}
+
+int ethernetDriverGetMtu()
+{
+    return atomic_load(&ethernet_mtu);
+}
+
+static size_t packetElementSize(int size_class)
+{
+    return (size_t)1 << (size_class + PACKET_MIN_SHIFT);
+}
+
+static size_t packetChunkSize(int size_class)
+{
+    return packetElementSize(size_class) > PACKET_CHUNK_SIZE ? packetElementSize(size_class) : PACKET_CHUNK_SIZE;
+}
+
+static struct Packet *packetAt(int size_class, unsigned index)
+{
+    size_t per_chunk = packetChunkSize(size_class) / packetElementSize(size_class);
+    char *chunk = atomic_load_explicit(&packet_classes[size_class].chunks[index / per_chunk], memory_order_acquire);
+    return (struct Packet *)(chunk + (index % per_chunk) * packetElementSize(size_class));
+}
+
+/* Pushes the chain of free packets from `first` to `last` (linked through
+`next_free`) onto the free list of their class */
+static void packetFreeListPush(struct PacketClass *packet_class, struct Packet *first, struct Packet *last)
+{
+    uint64_t head = atomic_load(&packet_class->free_list);
+    do
+    {
+        atomic_store(&last->next_free, (uint32_t)head);
+    } while (!atomic_compare_exchange_weak(&packet_class->free_list, &head,
+                                           ((head >> 32) + 1) << 32 | (first->index + 1)));
+}
+
+/* Adds a chunk of packets to the free list of `size_class`, unless another
+thread has refilled it in the meantime. Returns false if the pool limit is
+reached or no memory is left. */
+static bool packetClassGrow(int size_class)
+{
+    struct PacketClass *packet_class = &packet_classes[size_class];
+    size_t element_size = packetElementSize(size_class);
+    size_t chunk_size = packetChunkSize(size_class);
+    size_t per_chunk = chunk_size / element_size;
+    bool grown = true;
+    pthread_mutex_lock(&packet_grow_mutex);
+    unsigned chunk_index = atomic_load_explicit(&packet_class->chunk_count, memory_order_relaxed);
+    if ((uint32_t)atomic_load(&packet_class->free_list) != 0)
+    {
+        goto unlock;
+    }
+    if (chunk_index == PACKET_MAX_CHUNKS ||
+        atomic_fetch_add(&packet_pool_bytes, chunk_size) + chunk_size > PACKET_POOL_MAX_BYTES)
+    {
+        if (chunk_index < PACKET_MAX_CHUNKS)
+        {
+            atomic_fetch_sub(&packet_pool_bytes, chunk_size);
+        }
+        grown = false;
+        goto unlock;
+    }
+    char *chunk = aligned_alloc(64, chunk_size);
+    if (chunk == NULL)
+    {
+        atomic_fetch_sub(&packet_pool_bytes, chunk_size);
+        grown = false;
+        goto unlock;
+    }
+    for (size_t i = 0; i < per_chunk; i++)
+    {
+        struct Packet *packet = (struct Packet *)(chunk + i * element_size);
+        packet->capacity = element_size - sizeof(struct Packet);
+        packet->size_class = size_class;
+        packet->index = chunk_index * per_chunk + i;
+        /* the chunk's packets are linked in order and pushed at once */
+        atomic_init(&packet->next_free, i + 1 < per_chunk ? packet->index + 2 : 0);
+    }
+    atomic_store_explicit(&packet_class->chunks[chunk_index], chunk, memory_order_release);
+    atomic_store_explicit(&packet_class->chunk_count, chunk_index + 1, memory_order_relaxed);
+    packetFreeListPush(packet_class, (struct Packet *)chunk, (struct Packet *)(chunk + (per_chunk - 1) * element_size));
+unlock:
+    pthread_mutex_unlock(&packet_grow_mutex);
+    return grown;
+}
+
+struct Packet *packetAlloc(int size)
+{
+    size_t needed = sizeof(struct Packet) + PACKET_HEADROOM + (size_t)size + PACKET_TAILROOM;
+    int size_class = 0;
+    while (size_class < PACKET_CLASSES && packetElementSize(size_class) < needed)
+    {
+        size_class++;
+    }
+    if (size < 0 || size_class == PACKET_CLASSES)
+    {
+        return NULL;
+    }
+    struct PacketClass *packet_class = &packet_classes[size_class];
+    uint64_t head = atomic_load(&packet_class->free_list);
+    for (;;)
+    {
+        if ((uint32_t)head == 0)
+        {
+            if (!packetClassGrow(size_class))
+            {
+                return NULL;
+            }
+            head = atomic_load(&packet_class->free_list);
+            continue;
+        }
+        struct Packet *packet = packetAt(size_class, (uint32_t)head - 1);
+        uint64_t next = ((head >> 32) + 1) << 32 | atomic_load(&packet->next_free);
+        if (atomic_compare_exchange_weak(&packet_class->free_list, &head, next))
+        {
+            packet->data = packet->buffer + PACKET_HEADROOM;
+            packet->size = 0;
+            atomic_init(&packet->references, 1);
+            return packet;
+        }
+    }
+}
+
+void packetRetain(struct Packet *packet)
+{
+    atomic_fetch_add_explicit(&packet->references, 1, memory_order_relaxed);
+}
+
+void packetRelease(struct Packet *packet)
+{
+    if (packet == NULL || atomic_fetch_sub_explicit(&packet->references, 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+    packetFreeListPush(&packet_classes[packet->size_class], packet, packet);
+}
+
+char *packetPush(struct Packet *packet, int bytes)
+{
+    assert(atomic_load(&packet->references) == 1 && "Packet is shared");
+    if (bytes < 0 || packet->data - packet->buffer < bytes)
+    {
+        return NULL;
+    }
+    packet->data -= bytes;
+    packet->size += bytes;
+    return packet->data;
+}
+
+char *packetPut(struct Packet *packet, int bytes)
+{
+    assert(atomic_load(&packet->references) == 1 && "Packet is shared");
+    char *end = packet->data + packet->size;
+    if (bytes < 0 || packet->buffer + packet->capacity - end < bytes)
+    {
+        return NULL;
+    }
+    packet->size += bytes;
+    return end;
+}
+
+/* The capture rings keep the last packets seen by the receive path, one
+ring per receive queue so that only the queue's producer writes to it.
+The writer marks a record with a sequence number (odd while it is
+written), so that an export running at the same time skips records that
+are being overwritten instead of stopping the data path. The data is
+stored in 64-bit words. */
+#define CAPTURE_DEFAULT_PACKETS 1024
+#define CAPTURE_DEFAULT_SNAP_LENGTH 128
+
+struct CaptureRecord
+{
+    atomic_uint_least64_t sequence; /* 2 * index + 2 when complete */
+    atomic_uint_least64_t timestamp; /* nanoseconds since the epoch */
+    atomic_uint original_length;
+    atomic_uint captured_length;
+    atomic_uint_least64_t words[];
+};
+
+struct CaptureRing
+{
+    _Alignas(64) atomic_uint_least64_t next; /* index of the next record to write */
+};
+
+static atomic_uint_least64_t capture_default_records[ETHERNET_MAX_QUEUES * CAPTURE_DEFAULT_PACKETS *
+                                                     (sizeof(struct CaptureRecord) + CAPTURE_DEFAULT_SNAP_LENGTH) / 8];
+static struct CaptureRing capture_rings[ETHERNET_MAX_QUEUES];
+/* the rings one after the other, each of `capture_size` records of
+`capture_stride` bytes */
+static char *capture_records = (char *)capture_default_records;
+static unsigned capture_size = CAPTURE_DEFAULT_PACKETS; /* a power of two, 0 if capturing is off */
+static unsigned capture_snap_length = CAPTURE_DEFAULT_SNAP_LENGTH;
+static size_t capture_stride = sizeof(struct CaptureRecord) + CAPTURE_DEFAULT_SNAP_LENGTH;
+
+bool ethernetDriverSetCapture(int packets, int snap_length)
+{
+    if (packets < 0 || snap_length < 0 || snap_length > PACKET_MAX_MTU)
+    {
+        return false;
+    }
+    unsigned size = 0;
+    if (packets > 0)
+    {
+        for (size = 1; size < (unsigned)packets; size *= 2)
+        {
+        }
+    }
+    size_t stride = sizeof(struct CaptureRecord) + (snap_length + 7) / 8 * 8;
+    char *records = NULL;
+    if (size > 0)
+    {
+        records = calloc((size_t)size * ETHERNET_MAX_QUEUES, stride);
+        if (records == NULL)
+        {
+            return false;
+        }
+    }
+    if (capture_records != (char *)capture_default_records)
+    {
+        free(capture_records);
+    }
+    capture_records = records;
+    capture_size = size;
+    capture_snap_length = snap_length;
+    capture_stride = stride;
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        atomic_store(&capture_rings[i].next, 0);
+    }
+    return true;
+}
+
+/* Returns the time stamp for the frames of a burst, which share one read
+of the clock (0 if capturing is off) */
+static uint64_t captureTimestamp()
+{
+    if (capture_size == 0)
+    {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static struct CaptureRecord *captureRecord(int queue_index, uint64_t index)
+{
+    size_t record = (size_t)queue_index * capture_size + (index & (capture_size - 1));
+    return (struct CaptureRecord *)(capture_records + record * capture_stride);
+}
+
+/* Records the first bytes of a frame of `size` bytes received at
+`timestamp` in the capture ring of `queue_index`. Only the producer of the
+queue may call it. */
+static void captureFrame(int queue_index, const char *data, int size, uint64_t timestamp)
+{
+    if (capture_size == 0)
+    {
+        return;
+    }
+    struct CaptureRing *ring = &capture_rings[queue_index];
+    uint64_t index = atomic_load_explicit(&ring->next, memory_order_relaxed);
+    struct CaptureRecord *record = captureRecord(queue_index, index);
+    unsigned captured = (unsigned)size < capture_snap_length ? (unsigned)size : capture_snap_length;
+    atomic_store_explicit(&record->sequence, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&record->timestamp, timestamp, memory_order_relaxed);
+    atomic_store_explicit(&record->original_length, size, memory_order_relaxed);
+    atomic_store_explicit(&record->captured_length, captured, memory_order_relaxed);
+    for (unsigned offset = 0; offset < captured; offset += 8)
+    {
+        uint64_t word = 0;
+        memcpy(&word, data + offset, captured - offset < 8 ? captured - offset : 8);
+        atomic_store_explicit(&record->words[offset / 8], word, memory_order_relaxed);
+    }
+    atomic_store_explicit(&record->sequence, 2 * index + 2, memory_order_release);
+    atomic_store_explicit(&ring->next, index + 1, memory_order_release);
+}
+
+/* Header of a pcap file with nanosecond timestamps */
+struct PcapFileHeader
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t timezone;
+    uint32_t timestamp_accuracy;
+    uint32_t snap_length;
+    uint32_t link_type;
+};
+
+struct PcapRecordHeader
+{
+    uint32_t seconds;
+    uint32_t nanoseconds;
+    uint32_t captured_length;
+    uint32_t original_length;
+};
+
+/* Copies record `index` of the ring of `queue_index` to `destination`
+(pcap record header followed by the data) and returns the number of
+bytes, or 0 if the record has been overwritten or is being written */
+static size_t exportCaptureRecord(int queue_index, uint64_t index, char *destination)
+{
+    struct CaptureRecord *record = captureRecord(queue_index, index);
+    if (atomic_load_explicit(&record->sequence, memory_order_acquire) != 2 * index + 2)
+    {
+        return 0;
+    }
+    uint64_t timestamp = atomic_load_explicit(&record->timestamp, memory_order_relaxed);
+    struct PcapRecordHeader header = {timestamp / 1000000000u, timestamp % 1000000000u,
+                                      atomic_load_explicit(&record->captured_length, memory_order_relaxed),
+                                      atomic_load_explicit(&record->original_length, memory_order_relaxed)};
+    if (header.captured_length > capture_snap_length)
+    {
+        return 0;
+    }
+    char *data = destination + sizeof(header);
+    for (unsigned offset = 0; offset < header.captured_length; offset += 8)
+    {
+        uint64_t word = atomic_load_explicit(&record->words[offset / 8], memory_order_relaxed);
+        memcpy(data + offset, &word, header.captured_length - offset < 8 ? header.captured_length - offset : 8);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&record->sequence, memory_order_relaxed) != 2 * index + 2)
+    {
+        return 0;
+    }
+    memcpy(destination, &header, sizeof(header));
+    return sizeof(header) + header.captured_length;
+}
+
+long ethernetDriverExportCapture(const char *filename)
+{
+    /* the records of each ring from `starts` to `ends` */
+    uint64_t starts[ETHERNET_MAX_QUEUES];
+    uint64_t ends[ETHERNET_MAX_QUEUES];
+    size_t maximum_size = sizeof(struct PcapFileHeader);
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        ends[i] = atomic_load_explicit(&capture_rings[i].next, memory_order_acquire);
+        starts[i] = ends[i] > capture_size ? ends[i] - capture_size : 0;
+        maximum_size += (ends[i] - starts[i]) * (sizeof(struct PcapRecordHeader) + capture_snap_length);
+    }
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    char *file = MAP_FAILED;
+    if (ftruncate(fd, maximum_size) == 0)
+    {
+        file = mmap(NULL, maximum_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (file == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    struct PcapFileHeader header = {0xa1b23c4d, 2, 4, 0, 0, capture_snap_length, 1 /* Ethernet */};
+    memcpy(file, &header, sizeof(header));
+    size_t size = sizeof(header);
+    long packets = 0;
+    for (;;)
+    {
+        /* each ring is in time order, so the earliest of their next
+        records comes next in the file */
+        int queue = -1;
+        uint64_t earliest = 0;
+        for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+        {
+            /* a record overwritten meanwhile carries the time stamp of a
+            newer frame, which must not hold back the older ones behind it */
+            while (starts[i] != ends[i] &&
+                   atomic_load_explicit(&captureRecord(i, starts[i])->sequence, memory_order_acquire) !=
+                       2 * starts[i] + 2)
+            {
+                starts[i]++;
+            }
+            if (starts[i] == ends[i])
+            {
+                continue;
+            }
+            uint64_t timestamp =
+                atomic_load_explicit(&captureRecord(i, starts[i])->timestamp, memory_order_relaxed);
+            if (queue == -1 || timestamp < earliest)
+            {
+                queue = i;
+                earliest = timestamp;
+            }
+        }
+        if (queue == -1)
+        {
+            break;
+        }
+        size_t record_size = exportCaptureRecord(queue, starts[queue]++, file + size);
+        size += record_size;
+        packets += (record_size > 0);
+    }
+    munmap(file, maximum_size);
+    bool success = (ftruncate(fd, size) == 0);
+    if (close(fd) == -1 || !success)
+    {
+        return -1;
+    }
+    return packets;
+}
+
+/* Number of packet slots in the receive ring (a power of two) */
+#define RX_RING_SIZE 1024
+
+/* Every receive queue is a ring filled by the driver (the only producer)
+and emptied by the consumer thread of the queue (the only consumer). Each
+index only ever grows and is written by one side, so no locks are needed;
+the slot of index i is slots[i % RX_RING_SIZE]. The ring only holds
+pointers: the packets themselves are handed to the caller without
+copying. */
+struct RxQueue
+{
+    struct Packet *slots[RX_RING_SIZE];
+    _Alignas(64) atomic_uint filled; /* written by the driver: slots before hold packets */
+    _Alignas(64) atomic_uint taken;  /* written by the consumer: slots before were handed out */
+    /* packets queued but not signaled through `event_fd` yet */
+    _Alignas(64) atomic_uint unsignaled;
+    int event_fd;
+    int timer_fd;
+};
+
+static struct RxQueue rx_queues[ETHERNET_MAX_QUEUES];
+static atomic_int rx_queue_count = 1;
+
+bool ethernetDriverSetRxQueues(int count)
+{
+    if (count < 1 || count > ETHERNET_MAX_QUEUES)
+    {
+        return false;
+    }
+    atomic_store(&rx_queue_count, count);
+    return true;
+}
+
+int ethernetDriverGetRxQueues()
+{
+    return atomic_load(&rx_queue_count);
+}
+
+/* The Microsoft RSS hash key, which most NICs use by default */
+static const uint8_t rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+
+/* The Toeplitz hash of RSS: for every set bit of `input`, the 32 key bits
+starting at that bit position are xor-ed into the result */
+static uint32_t toeplitzHash(const uint8_t *input, int length)
+{
+    uint32_t result = 0;
+    uint32_t window = (uint32_t)rss_key[0] << 24 | rss_key[1] << 16 | rss_key[2] << 8 | rss_key[3];
+    for (int i = 0; i < length; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            if (input[i] & (1 << bit))
+            {
+                result ^= window;
+            }
+            window = window << 1 | ((rss_key[i + 4] >> bit) & 1);
+        }
+    }
+    return result;
+}
+
+/* Receive-side scaling: hashes the flow key of an IPv4 frame (addresses,
+plus the ports for TCP and UDP) so that all packets of a flow land on the
+same queue. Other frames go to queue 0. */
+static int rssQueue(const struct Packet *packet, int queue_count)
+{
+    const uint8_t *frame = (const uint8_t *)packet->data;
+    if (queue_count == 1 || packet->size < 14 + 20 || frame[12] != 0x08 || frame[13] != 0x00)
+    {
+        return 0;
+    }
+    const uint8_t *ip = frame + 14;
+    int header_length = (ip[0] & 0x0f) * 4;
+    uint8_t key[12];
+    int key_length = 8;
+    memcpy(key, ip + 12, 8);
+    bool has_ports = (ip[9] == 6 || ip[9] == 17);
+    bool fragment = (ip[6] & 0x3f) != 0 || ip[7] != 0;
+    if (has_ports && !fragment && packet->size >= 14 + header_length + 4)
+    {
+        memcpy(key + 8, ip + header_length, 4);
+        key_length = 12;
+    }
+    return toeplitzHash(key, key_length) % queue_count;
+}
+
+/* Like a NIC's interrupt moderation, the receive path counts the packets
+of each queue it has not signaled yet. It signals the queue's eventfd
+when the count reaches `rx_coalesce_packets`, and arms the queue's timer
+with the first packet; when a timer expires, a driver thread signals the
+packets that are still unsignaled. */
+static atomic_int rx_coalesce_packets = 32;
+static atomic_int rx_coalesce_microseconds = 50;
+static atomic_bool rx_events_enabled;
+static int rx_timer_epoll_fd = -1;
+static pthread_once_t rx_events_once = PTHREAD_ONCE_INIT;
+
+static void rxSignal(struct RxQueue *queue, unsigned packets)
+{
+    uint64_t value = packets;
+    while (write(queue->event_fd, &value, sizeof(value)) == -1 && errno == EINTR)
+    {
+    }
+}
+
+/* The coalescing timer thread of all queues */
+static void *rxTimerThread(void *argument)
+{
+    (void)argument;
+    for (;;)
+    {
+        struct epoll_event events[ETHERNET_MAX_QUEUES];
+        int count = epoll_wait(rx_timer_epoll_fd, events, ETHERNET_MAX_QUEUES, -1);
+        for (int i = 0; i < count; i++)
+        {
+            struct RxQueue *queue = &rx_queues[events[i].data.u32];
+            uint64_t expirations;
+            if (read(queue->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            {
+                continue;
+            }
+            unsigned packets = atomic_exchange(&queue->unsignaled, 0);
+            if (packets > 0)
+            {
+                rxSignal(queue, packets);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void closeRxEvents()
+{
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        if (rx_queues[i].event_fd != -1)
+        {
+            close(rx_queues[i].event_fd);
+        }
+        if (rx_queues[i].timer_fd != -1)
+        {
+            close(rx_queues[i].timer_fd);
+        }
+        rx_queues[i].event_fd = -1;
+        rx_queues[i].timer_fd = -1;
+    }
+    if (rx_timer_epoll_fd != -1)
+    {
+        close(rx_timer_epoll_fd);
+    }
+    rx_timer_epoll_fd = -1;
+}
+
+static void initRxEvents()
+{
+    rx_timer_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bool success = (rx_timer_epoll_fd != -1);
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        struct RxQueue *queue = &rx_queues[i];
+        queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        queue->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = i};
+        success = success && queue->event_fd != -1 && queue->timer_fd != -1 &&
+                  epoll_ctl(rx_timer_epoll_fd, EPOLL_CTL_ADD, queue->timer_fd, &event) == 0;
+    }
+    pthread_t thread;
+    if (!success || pthread_create(&thread, NULL, rxTimerThread, NULL) != 0)
+    {
+        closeRxEvents();
+        return;
+    }
+    pthread_detach(thread);
+    atomic_store(&rx_events_enabled, true);
+    /* packets that arrived before are signaled right away */
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        if (atomic_load(&rx_queues[i].filled) != atomic_load(&rx_queues[i].taken))
+        {
+            rxSignal(&rx_queues[i], 1);
+        }
+    }
+}
+
+int ethernetDriverGetRxQueueEventFd(int queue)
+{
+    assert(queue >= 0 && queue < ETHERNET_MAX_QUEUES && "Invalid queue");
+    pthread_once(&rx_events_once, initRxEvents);
+    return atomic_load(&rx_events_enabled) ? rx_queues[queue].event_fd : -1;
+}
+
+int ethernetDriverGetRxEventFd()
+{
+    return ethernetDriverGetRxQueueEventFd(0);
+}
+
+void ethernetDriverAckRxQueueEvent(int queue)
+{
+    uint64_t value;
+    if (atomic_load(&rx_events_enabled))
+    {
+        while (read(rx_queues[queue].event_fd, &value, sizeof(value)) == -1 && errno == EINTR)
+        {
+        }
+    }
+}
+
+void ethernetDriverAckRxEvent()
+{
+    ethernetDriverAckRxQueueEvent(0);
+}
+
+void ethernetDriverSetRxCoalescing(int packets, int microseconds)
+{
+    atomic_store(&rx_coalesce_packets, packets < 1 ? 1 : packets);
+    atomic_store(&rx_coalesce_microseconds, microseconds < 0 ? 0 : microseconds);
+}
+
+/* Called by the receive path after each packet queued in `queue` */
+static void rxPacketQueued(struct RxQueue *queue)
+{
+    if (!atomic_load_explicit(&rx_events_enabled, memory_order_relaxed))
+    {
+        return;
+    }
+    unsigned unsignaled = atomic_fetch_add(&queue->unsignaled, 1) + 1;
+    int microseconds = atomic_load_explicit(&rx_coalesce_microseconds, memory_order_relaxed);
+    if (unsignaled >= (unsigned)atomic_load_explicit(&rx_coalesce_packets, memory_order_relaxed) ||
+        microseconds == 0)
+    {
+        unsigned packets = atomic_exchange(&queue->unsignaled, 0);
+        if (packets > 0)
+        {
+            rxSignal(queue, packets);
+        }
+    }
+    else if (unsignaled == 1)
+    {
+        struct itimerspec timer = {.it_value = {microseconds / 1000000, (microseconds % 1000000) * 1000}};
+        timerfd_settime(queue->timer_fd, 0, &timer, NULL);
+    }
+}
+
+/* Gathers the `count` segments of a frame one after the other into a
+packet of the frame's size, queues it in the receive queue of its flow and
+records it for the capture with `timestamp`. Returns false (and drops the
+frame) if its payload is longer than the MTU, no packet is left or the
+consumer has not taken enough packets out of the queue. */
+static bool rxRingPushSegments(const struct PacketSegment *segments, int count, uint64_t timestamp)
+{
+    size_t size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size += segments[i].length;
+    }
+    if (size > (size_t)atomic_load_explicit(&ethernet_mtu, memory_order_relaxed) + ETHERNET_HEADER_SIZE +
+                   ETHERNET_VLAN_TAG_SIZE)
+    {
+        statCountDropped(ETHERNET_DROP_TOO_LONG);
+        return false;
+    }
+    struct Packet *packet = packetAlloc((int)size);
+    if (packet == NULL)
+    {
+        statCountDropped(ETHERNET_DROP_NO_BUFFER);
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(packetPut(packet, (int)segments[i].length), segments[i].data, segments[i].length);
+    }
+    int queue_index = rssQueue(packet, atomic_load_explicit(&rx_queue_count, memory_order_relaxed));
+    struct RxQueue *queue = &rx_queues[queue_index];
+    unsigned filled = atomic_load_explicit(&queue->filled, memory_order_relaxed);
+    unsigned taken = atomic_load_explicit(&queue->taken, memory_order_acquire);
+    if (filled - taken == RX_RING_SIZE)
+    {
+        packetRelease(packet);
+        statCountDropped(ETHERNET_DROP_RX_RING_FULL);
+        return false;
+    }
+    /* only frames that are received are recorded; this is the last moment
+    the packet belongs to the driver, as the consumer may release it as soon
+    as it is in the queue */
+    captureFrame(queue_index, packet->data, packet->size, timestamp);
+    queue->slots[filled % RX_RING_SIZE] = packet;
+    atomic_store_explicit(&queue->filled, filled + 1, memory_order_release);
+    statCountReceived(queue_index, 1, size);
+    rxPacketQueued(queue);
+    return true;
+}
+
+/* Called by the driver's receive path for every frame from the hardware.
+Copies the frame into a packet of its size and queues it. Returns false
+if the frame is dropped. */
+bool ethernetDriverRxRingPush(const char *data, int size)
+{
+    if (size < 0)
+    {
+        statCountDropped(ETHERNET_DROP_TOO_LONG);
+        return false;
+    }
+    struct PacketSegment segment = {data, (size_t)size};
+    return rxRingPushSegments(&segment, 1, captureTimestamp());
+}
+
+int ethernetDriverRecvBurstQueue(int queue_index, struct Packet *slots[], int max)
+{
+    assert(queue_index >= 0 && queue_index < ETHERNET_MAX_QUEUES && "Invalid queue");
+    struct RxQueue *queue = &rx_queues[queue_index];
+    unsigned taken = atomic_load_explicit(&queue->taken, memory_order_relaxed);
+    unsigned filled = atomic_load_explicit(&queue->filled, memory_order_acquire);
+    int count = 0;
+    while (count < max && taken + count != filled)
+    {
+        slots[count] = queue->slots[(taken + count) % RX_RING_SIZE];
+        count++;
+    }
+    atomic_store_explicit(&queue->taken, taken + count, memory_order_release);
+    return count;
+}
+
+int ethernetDriverRecvBurst(struct Packet *slots[], int max)
+{
+    return ethernetDriverRecvBurstQueue(0, slots, max);
+}
+
+void ethernetDriverReleaseBurst(struct Packet *slots[], int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        packetRelease(slots[i]);
+    }
+}
+
+struct Packet *ethernetDriverGetPacket()
+{
+    struct Packet *packet;
+    return ethernetDriverRecvBurst(&packet, 1) == 1 ? packet : NULL;
+}
+
+/* The loopback backend stands in for the hardware: every sent packet is
+received again in the receive ring. It stops at the first packet that
+does not fit into the ring. As the ring has a single producer, only one
+thread may send through this backend at a time. */
+static int loopbackTransmit(const struct PacketView *pkts, int n)
+{
+    int sent = 0;
+    uint64_t timestamp = captureTimestamp();
+    while (sent < n && rxRingPushSegments(pkts[sent].segments, pkts[sent].segment_count, timestamp))
+    {
+        sent++;
+    }
+    return sent;
+}
+
+static const struct EthernetBackend loopback_backend = {"loopback", loopbackTransmit};
+static const struct EthernetBackend *_Atomic tx_backend = &loopback_backend;
+
+void ethernetDriverSetBackend(const struct EthernetBackend *backend)
+{
+    atomic_store(&tx_backend, backend);
+}
+
+/* Counts a completed send burst in one update of the statistics */
+static void statCountSent(int queue, uint64_t sent, uint64_t failed, uint64_t bytes)
+{
+    struct StatSlot *slot = statBegin();
+    statAdd(slot, STAT_TOTAL_SENT_PACKETS, sent + failed);
+    statAdd(slot, STAT_SUCCESSFULLY_SENT_PACKETS, sent);
+    statAdd(slot, STAT_FAILED_SENT_PACKETS, failed);
+    statAdd(slot, STAT_SENT_BYTES, bytes);
+    statAdd(slot, STAT_QUEUES + 4 * queue + 2, sent);
+    statAdd(slot, STAT_QUEUES + 4 * queue + 3, bytes);
+    statEnd(slot);
+}
+
+int ethernetDriverSendBurst(const struct PacketView *pkts, int n)
+{
+    const struct EthernetBackend *backend = atomic_load(&tx_backend);
+    int sent = n > 0 ? backend->transmit(pkts, n) : 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < sent; i++)
+    {
+        for (int j = 0; j < pkts[i].segment_count; j++)
+        {
+            bytes += pkts[i].segments[j].length;
+        }
+    }
+    if (n > 0)
+    {
+        statCountSent(0, sent, n - sent, bytes);
+    }
+    return sent;
+}
+
 // Caller’s code
 
-void ethShow()
+/* Prints the driver's state and, if `capture_filename` is not NULL,
+writes the captured packets to that pcap file */
+void ethShow(const char *capture_filename)
 {
-    struct EthernetDriverStat eth_stat = ethernetDriverGetStatistics();
-    printf("%i packets received\n", eth_stat.received_packets);
-    printf("%i packets sent\n", eth_stat.total_sent_packets);
-    printf("%i packets successfully sent\n", eth_stat.successfully_sent_packets);
-    printf("%i packets failed to send\n", eth_stat.failed_sent_packets);
+    struct EthernetDriverStatExtended eth_stat;
+    ethernetDriverGetStatisticsExtended(&eth_stat);
+    printf("%llu packets received (%llu bytes)\n", (unsigned long long)eth_stat.received_packets,
+           (unsigned long long)eth_stat.received_bytes);
+    printf("%llu packets sent (%llu bytes)\n", (unsigned long long)eth_stat.total_sent_packets,
+           (unsigned long long)eth_stat.sent_bytes);
+    printf("%llu packets successfully sent\n", (unsigned long long)eth_stat.successfully_sent_packets);
+    printf("%llu packets failed to send\n", (unsigned long long)eth_stat.failed_sent_packets);
+    printf("%llu packets dropped (ring full), %llu packets dropped (too long), %llu packets dropped (no buffer)\n",
+           (unsigned long long)eth_stat.dropped_packets[ETHERNET_DROP_RX_RING_FULL],
+           (unsigned long long)eth_stat.dropped_packets[ETHERNET_DROP_TOO_LONG],
+           (unsigned long long)eth_stat.dropped_packets[ETHERNET_DROP_NO_BUFFER]);
+    for (int i = 0; i < ETHERNET_MAX_QUEUES; i++)
+    {
+        if (eth_stat.queues[i].received_packets != 0 || eth_stat.queues[i].sent_packets != 0)
+        {
+            printf("Queue %i: %llu packets received, %llu packets sent\n", i,
+                   (unsigned long long)eth_stat.queues[i].received_packets,
+                   (unsigned long long)eth_stat.queues[i].sent_packets);
+        }
+    }
 
     const struct EthernetDriverInfo *eth_info = ethernetDriverGetInfo();
     printf("Driver name: %s\n", eth_info->name);
@@ -60,8 +1221,312 @@ void ethShow()
     ethernetDriverGetIp(&ip);
     printf("IP address: %s\n", ip.address);
 
-    struct Packet *packet = ethernetDriverGetPacket();
-    printf("Packet Dump:");
-    fwrite(packet->data, 1, packet->size, stdout);
-    free(packet);
-}
\ No newline at end of file
+    if (capture_filename != NULL)
+    {
+        long packets = ethernetDriverExportCapture(capture_filename);
+        printf("Packet Dump: %li packets written to %s\n", packets, capture_filename);
+    }
+}
+
+/* Sends `packet_count` packets of `packet_size` bytes (a 14-byte header
+and the payload as two segments) in bursts of `burst_size` through the
+loopback backend, receives them again and returns the rate in million
+packets per second */
+double ethBenchmarkLoopback(int packet_size, int burst_size, long packet_count)
+{
+    static char header[ETHERNET_HEADER_SIZE];
+    static char payload[PACKET_MAX_MTU];
+    assert(packet_size >= ETHERNET_HEADER_SIZE && packet_size <= ethernetDriverGetMtu() + ETHERNET_HEADER_SIZE &&
+           burst_size > 0 && burst_size <= 256);
+    struct PacketSegment segments[2] = {{header, sizeof(header)}, {payload, packet_size - sizeof(header)}};
+    struct PacketView views[256];
+    for (int i = 0; i < burst_size; i++)
+    {
+        views[i] = (struct PacketView){segments, 2};
+    }
+    struct Packet *packets[256];
+    ethernetDriverSetBackend(&loopback_backend);
+    ethernetDriverSetRxQueues(1);
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long done = 0; done < packet_count;)
+    {
+        int sent = ethernetDriverSendBurst(views, burst_size);
+        int received = ethernetDriverRecvBurst(packets, 256);
+        ethernetDriverReleaseBurst(packets, received);
+        done += sent;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return packet_count / seconds / 1e6;
+}
+
+/* Result of `ethBenchmarkRxEvents` */
+struct RxEventBenchmark
+{
+    long packets; /* received, without the ones the driver dropped */
+    double median_latency_us;
+    double p99_latency_us;
+    double max_latency_us;
+    double consumer_cpu_percent; /* CPU time of the consumer per wall time */
+};
+
+struct TrafficGenerator
+{
+    int packets_per_second;
+    long packets;
+    atomic_long accepted; /* frames the driver did not drop */
+    atomic_bool finished;
+};
+
+static uint64_t monotonicNanoseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/* Pushes `packets` 64-byte frames carrying their send time at a constant
+rate into the receive path */
+static void *generateTraffic(void *argument)
+{
+    struct TrafficGenerator *generator = argument;
+    uint64_t interval = 1000000000u / generator->packets_per_second;
+    uint64_t next = monotonicNanoseconds();
+    char frame[64] = {0};
+    for (long i = 0; i < generator->packets; i++)
+    {
+        next += interval;
+        struct timespec wakeup = {next / 1000000000u, next % 1000000000u};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+        uint64_t now = monotonicNanoseconds();
+        memcpy(frame, &now, sizeof(now));
+        if (ethernetDriverRxRingPush(frame, sizeof(frame)))
+        {
+            atomic_fetch_add(&generator->accepted, 1);
+        }
+    }
+    atomic_store(&generator->finished, true);
+    return NULL;
+}
+
+static int compareLatencies(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Receives synthetic traffic of `packets_per_second` for `packets`
+packets in an epoll loop on the driver's event file descriptor, and
+stores the latency from sending to receiving and the CPU use of the
+receiving thread into `result`. Frames the driver drops are not waited
+for. Returns false if `packets_per_second` or `packets` is not positive,
+if the event file descriptor or the generator thread could not be set up,
+or if no packet was received. */
+bool ethBenchmarkRxEvents(int packets_per_second, long packets, struct RxEventBenchmark *result)
+{
+    if (packets_per_second <= 0 || packets <= 0)
+    {
+        return false;
+    }
+    int event_fd = ethernetDriverGetRxEventFd();
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    uint64_t *latencies = malloc(packets * sizeof(uint64_t));
+    struct epoll_event event = {.events = EPOLLIN};
+    pthread_t thread;
+    struct TrafficGenerator generator = {.packets_per_second = packets_per_second, .packets = packets};
+    if (event_fd == -1 || epoll_fd == -1 || latencies == NULL ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event) == -1 ||
+        pthread_create(&thread, NULL, generateTraffic, &generator) != 0)
+    {
+        if (epoll_fd != -1)
+        {
+            close(epoll_fd);
+        }
+        free(latencies);
+        return false;
+    }
+    struct timespec cpu_start;
+    struct timespec cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    uint64_t wall_start = monotonicNanoseconds();
+    long received = 0;
+    for (;;)
+    {
+        /* read `finished` before `accepted`, so that the count is final */
+        bool finished = atomic_load(&generator.finished);
+        if (received == packets || (finished && received == atomic_load(&generator.accepted)))
+        {
+            break;
+        }
+        struct epoll_event ready;
+        int ready_count = epoll_wait(epoll_fd, &ready, 1, 1000);
+        if (ready_count <= 0)
+        {
+            /* a frame that was accepted but never delivered must not
+            hang the benchmark */
+            if (finished && ready_count == 0)
+            {
+                break;
+            }
+            continue;
+        }
+        ethernetDriverAckRxEvent();
+        struct Packet *burst[64];
+        int count;
+        while ((count = ethernetDriverRecvBurst(burst, 64)) > 0)
+        {
+            uint64_t now = monotonicNanoseconds();
+            for (int i = 0; i < count; i++)
+            {
+                uint64_t sent;
+                memcpy(&sent, burst[i]->data, sizeof(sent));
+                if (received < packets)
+                {
+                    latencies[received++] = now - sent;
+                }
+            }
+            ethernetDriverReleaseBurst(burst, count);
+        }
+    }
+    uint64_t wall_time = monotonicNanoseconds() - wall_start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    pthread_join(thread, NULL);
+    close(epoll_fd);
+    if (received == 0)
+    {
+        free(latencies);
+        return false;
+    }
+
+    qsort(latencies, received, sizeof(uint64_t), compareLatencies);
+    result->packets = received;
+    result->median_latency_us = latencies[received / 2] / 1e3;
+    result->p99_latency_us = latencies[received * 99 / 100] / 1e3;
+    result->max_latency_us = latencies[received - 1] / 1e3;
+    result->consumer_cpu_percent = ((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec)) /
+                                   wall_time * 100;
+    free(latencies);
+    return true;
+}
+
+/* Result of `ethBenchmarkRss` */
+struct RssBenchmark
+{
+    double million_packets_per_second;
+    long packets_per_queue[ETHERNET_MAX_QUEUES];
+    /* packets of a flow that arrived on another queue than its first one */
+    long misrouted_packets;
+};
+
+#define RSS_BENCHMARK_FLOWS 4096
+
+struct RssConsumer
+{
+    int queue;
+    long packets;
+    long misrouted;
+    atomic_long *remaining;
+    atomic_int *flow_queues;
+    uint32_t checksum;
+};
+
+/* Empties one receive queue until all packets are received, touching
+every byte of each packet like a real consumer would */
+static void *consumeRssQueue(void *argument)
+{
+    struct RssConsumer *consumer = argument;
+    struct Packet *burst[64];
+    while (atomic_load_explicit(consumer->remaining, memory_order_relaxed) > 0)
+    {
+        int count = ethernetDriverRecvBurstQueue(consumer->queue, burst, 64);
+        if (count == 0)
+        {
+            /* leave the CPU to the producer if there are more threads than CPUs */
+            sched_yield();
+        }
+        for (int i = 0; i < count; i++)
+        {
+            const uint8_t *frame = (const uint8_t *)burst[i]->data;
+            for (int j = 0; j < burst[i]->size; j++)
+            {
+                consumer->checksum = consumer->checksum * 31 + frame[j];
+            }
+            int flow = (frame[34] << 8 | frame[35]) % RSS_BENCHMARK_FLOWS;
+            int expected = -1;
+            if (!atomic_compare_exchange_strong(&consumer->flow_queues[flow], &expected, consumer->queue) &&
+                expected != consumer->queue)
+            {
+                consumer->misrouted++;
+            }
+        }
+        ethernetDriverReleaseBurst(burst, count);
+        consumer->packets += count;
+        atomic_fetch_sub_explicit(consumer->remaining, count, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+/* Pushes `packet_count` 256-byte UDP/IPv4 frames of many flows into the
+receive path as fast as the queues take them, with one consumer thread
+per queue for `queue_count` queues, and stores the throughput and the
+distribution into `result`. Returns false if the threads could not be
+started. */
+bool ethBenchmarkRss(int queue_count, long packet_count, struct RssBenchmark *result)
+{
+    if (!ethernetDriverSetRxQueues(queue_count))
+    {
+        return false;
+    }
+    atomic_long remaining = packet_count;
+    static atomic_int flow_queues[RSS_BENCHMARK_FLOWS];
+    for (int i = 0; i < RSS_BENCHMARK_FLOWS; i++)
+    {
+        atomic_init(&flow_queues[i], -1);
+    }
+    struct RssConsumer consumers[ETHERNET_MAX_QUEUES];
+    pthread_t threads[ETHERNET_MAX_QUEUES];
+    int started = 0;
+    for (; started < queue_count; started++)
+    {
+        consumers[started] = (struct RssConsumer){.queue = started, .remaining = &remaining, .flow_queues = flow_queues};
+        if (pthread_create(&threads[started], NULL, consumeRssQueue, &consumers[started]) != 0)
+        {
+            break;
+        }
+    }
+    /* Ethernet + IPv4 (10.0.0.1 -> 10.0.0.2) + UDP header, source port = flow */
+    uint8_t frame[256] = {[12] = 0x08, [14] = 0x45, [23] = 17, [26] = 10, [29] = 1, [30] = 10, [33] = 2};
+    uint64_t start = monotonicNanoseconds();
+    for (long i = 0; i < packet_count && started == queue_count; i++)
+    {
+        int flow = (int)(i * 2654435761u % RSS_BENCHMARK_FLOWS);
+        frame[34] = flow >> 8;
+        frame[35] = flow & 0xff;
+        while (!ethernetDriverRxRingPush((const char *)frame, sizeof(frame)))
+        {
+            /* the queue of this flow is full, wait for its consumer */
+            sched_yield();
+        }
+    }
+    if (started < queue_count)
+    {
+        atomic_store(&remaining, 0);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (monotonicNanoseconds() - start) / 1e9;
+    memset(result, 0, sizeof(*result));
+    result->million_packets_per_second = packet_count / seconds / 1e6;
+    for (int i = 0; i < started; i++)
+    {
+        result->packets_per_queue[i] = consumers[i].packets;
+        result->misrouted_packets += consumers[i].misrouted;
+    }
+    ethernetDriverSetRxQueues(1);
+    return started == queue_count;
+}